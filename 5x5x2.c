@@ -38,12 +38,16 @@
 #include "macro.h"
 #include "matrix.h"
 #include "mouse.h"
+#include "mousekey.h"
 #include "rotary.h"
 #include "serial.h"
+#include "type.h"
 #include "usb.h"
 #include "rgbpixel.h"
 #include "rgbease.h"
 
+#define ELOG_MODULE ELOG_MAIN
+
 static bool enumeration_active;
 
 static void
@@ -59,6 +63,7 @@ void
 usb_reset(void)
 {
     elog("usb reset");
+    usb_stats.resets++;
     enumeration_active = true;
 }
 
@@ -66,12 +71,14 @@ void
 usb_resume(void)
 {
     elog("usb resume");
+    usb_stats.resumes++;
 }
 
 void
 usb_suspend(void)
 {
     elog("usb suspend");
+    usb_stats.suspends++;
 }
 
 int
@@ -86,10 +93,12 @@ main(void)
     clock_init();
     crc_init();
     serial_init();
+    elog_init();
     led_init();
     light_init();
     matrix_init();
     macro_init();
+    type_init();
     rotary_init();
 
     rgbpixel_init();
@@ -128,7 +137,7 @@ main(void)
             }
 
             if (!usb_ifs_enumerated) {
-                elog("enumeration failed");
+                elog_error("enumeration failed");
                 scb_reset_system();
             } else {
                 enumeration_active = false;
@@ -141,12 +150,18 @@ main(void)
         rgbease_process();
 
         if (serial_active) {
+            serial_process();
+            elog_process();
             serial_out();
         }
 
         if (keyboard_active) {
             matrix_row_process();
+            keyboard_process();
             rotary_process();
+            mouse_process();
+            mousekey_process();
+            automouse_pointer_process();
         }
 
         if (automouse_active) {
@@ -156,5 +171,13 @@ main(void)
         if (macro_active) {
             macro_run();
         }
+
+        if (type_active) {
+            type_process();
+        }
+
+        if (flash_active) {
+            flash_process();
+        }
     }
 }
@@ -30,6 +30,10 @@
  *
  * Mouse autoclicker -- something my son needed, click mouse button
  * many times, while wiggling the pointer somewhat.
+ *
+ * The absolute pointer moves to exact screen coordinates and clicks there,
+ * so that scripted click sequences do not drift. Reports are queued and
+ * sent one per extrakey endpoint transfer.
  */
 
 #include "automouse.h"
@@ -38,6 +42,8 @@
 #include "led.h"
 #include "mouse.h"
 
+#define ELOG_MODULE ELOG_AUTOMOUSE
+
 static report_mouse_t automouse_state;
 
 volatile uint8_t automouse_active = 0;
@@ -45,10 +51,17 @@ static volatile uint8_t automouse_press = 0;
 static volatile uint8_t automouse_times = 0;
 static uint32_t automouse_timer = 0;
 
+#define POINTER_QUEUE_NUM 8
+
+static report_pointer_t pointer_state = { .id = REPORTID_POINTER };
+static report_pointer_t pointer_queue[POINTER_QUEUE_NUM];
+static uint8_t pointer_head = 0;
+static uint8_t pointer_tail = 0;
+
 void
 automouse_event(event_t *event, bool pressed)
 {
-    elog("automouse %02x %02x %d", event->automouse.button, event->automouse.wiggle, pressed);
+    elog_debug("automouse %02x %02x %d", event->automouse.button, event->automouse.wiggle, pressed);
 
     automouse_state.buttons = event->automouse.button;
     automouse_state.x = event->automouse.wiggle;
@@ -95,3 +108,79 @@ automouse_repeat()
         automouse_timer = timer_set(automouse_times);
     }
 }
+
+report_pointer_t *
+automouse_pointer_report()
+{
+    return &pointer_state;
+}
+
+static uint8_t
+automouse_pointer_free(void)
+{
+    return (pointer_tail + POINTER_QUEUE_NUM - pointer_head - 1) %
+        POINTER_QUEUE_NUM;
+}
+
+static void
+automouse_pointer_queue(uint16_t x, uint16_t y, uint8_t buttons)
+{
+    uint8_t next = (pointer_head + 1) % POINTER_QUEUE_NUM;
+
+    pointer_queue[pointer_head].id = REPORTID_POINTER;
+    pointer_queue[pointer_head].buttons = buttons;
+    pointer_queue[pointer_head].x = (x > POINTER_MAX) ? POINTER_MAX : x;
+    pointer_queue[pointer_head].y = (y > POINTER_MAX) ? POINTER_MAX : y;
+    pointer_head = next;
+}
+
+/*
+ * Move the pointer to x, y with buttons held. A click releases the buttons
+ * again in the next report; it is queued whole or not at all, so a button
+ * is never left down.
+ */
+void
+automouse_pointer(uint16_t x, uint16_t y, uint8_t buttons, bool click)
+{
+    click = click && buttons;
+
+    if (automouse_pointer_free() < (click ? 2 : 1)) {
+        elog_warn("pointer queue full");
+        return;
+    }
+
+    automouse_pointer_queue(x, y, buttons);
+    if (click) {
+        automouse_pointer_queue(x, y, 0);
+    }
+    automouse_pointer_process();
+}
+
+/*
+ * Key events carry 8 bit coordinates, a fraction of the screen in 1/256ths.
+ * The buttons are held for as long as the key is.
+ */
+void
+automouse_pointer_event(event_t *event, bool pressed)
+{
+    uint16_t x = event->pointer.x << 7;
+    uint16_t y = event->pointer.y << 7;
+
+    elog_debug("pointer %02x %02x %02x %d", event->pointer.button,
+               event->pointer.x, event->pointer.y, pressed);
+
+    automouse_pointer(x, y, pressed ? event->pointer.button : 0, false);
+}
+
+void
+automouse_pointer_process()
+{
+    if ((pointer_head == pointer_tail) ||
+        (! usb_ep_extrakey_idle)) {
+        return;
+    }
+
+    pointer_state = pointer_queue[pointer_tail];
+    pointer_tail = (pointer_tail + 1) % POINTER_QUEUE_NUM;
+    usb_update_pointer(&pointer_state);
+}
@@ -30,10 +30,16 @@
 
 #include <stdint.h>
 #include "keymap.h"
+#include "usb.h"
 
 extern volatile uint8_t automouse_active;
 
 void automouse_event(event_t *event, bool pressed);
 void automouse_repeat(void);
 
+report_pointer_t *automouse_pointer_report(void);
+void automouse_pointer(uint16_t x, uint16_t y, uint8_t buttons, bool click);
+void automouse_pointer_event(event_t *event, bool pressed);
+void automouse_pointer_process(void);
+
 #endif /* _AUTOMOUSE_H */
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BOOT_H
+#define _BOOT_H
+
+/*
+ * Flash layout:
+ *
+ * | address    | size | contents                                     |
+ * |------------+------+----------------------------------------------|
+ * | 0x08000000 |   8K | dfu bootloader, never overwritten by updates |
+ * | 0x08002000 |  52K | firmware, last word holds the image crc      |
+ * | 0x0800F000 |   4K | .userflash configuration                     |
+ *
+ * These must match the rom regions in stm32f103c8t6.ld and
+ * bootloader/bootloader.ld.
+ */
+#define BOOT_APP_BASE                           0x08002000
+#define BOOT_APP_END                            0x0800F000
+#define BOOT_APP_CRC                            (BOOT_APP_END - 4)
+
+/*
+ * Backup register value that asks the bootloader to stay in dfu mode
+ * instead of starting the firmware. Backup registers survive a system
+ * reset, ram might not.
+ */
+#define BOOT_MAGIC_DFU                          0xdf00
+
+void boot_dfu(void);
+
+#endif /* _BOOT_H */
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * bootloader
+ *
+ * Resident usb dfu bootloader. At reset it starts the firmware, unless:
+ * - the firmware asked for dfu mode through a backup register
+ * - the firmware image crc does not check out
+ * In both cases it stays on the bus as a dfu 1.1 device that accepts a
+ * new image. Only the firmware region is ever written; the bootloader
+ * itself and .userflash configuration are left alone. When a transfer
+ * fails, the image crc will not match and the board comes back up in dfu
+ * mode, ready for another try.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/f1/bkp.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include <libopencm3/usb/dfu.h>
+#include <libopencm3/usb/usbd.h>
+
+#include "../boot.h"
+#include "../config.h"
+
+#define DFU_TRANSFER_SIZE  1024
+#define DFU_PAGE_SIZE      1024
+
+static usbd_device *usbd_dev;
+static uint8_t usbd_control_buffer[DFU_TRANSFER_SIZE] __attribute__((aligned));
+
+static enum dfu_state dfu_state = STATE_DFU_IDLE;
+static enum dfu_status dfu_status = DFU_STATUS_OK;
+
+static struct {
+    uint8_t buf[DFU_TRANSFER_SIZE];
+    uint16_t len;
+    uint16_t blocknum;
+} prog;
+
+const struct usb_device_descriptor dev_descriptor = {
+    .bLength = USB_DT_DEVICE_SIZE,
+    .bDescriptorType = USB_DT_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = 0,
+    .bDeviceSubClass = 0,
+    .bDeviceProtocol = 0,
+    .bMaxPacketSize0 = 64,
+    .idVendor = 0xDEAD,
+    .idProduct = 0xDF11,
+    .bcdDevice = 0x0100,
+    .iManufacturer = 1,
+    .iProduct = 2,
+    .iSerialNumber = 3,
+    .bNumConfigurations = 1,
+};
+
+const struct usb_dfu_descriptor dfu_function = {
+    .bLength = sizeof(struct usb_dfu_descriptor),
+    .bDescriptorType = DFU_FUNCTIONAL,
+    .bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_WILL_DETACH,
+    .wDetachTimeout = 255,
+    .wTransferSize = DFU_TRANSFER_SIZE,
+    .bcdDFUVersion = 0x0110,
+};
+
+const struct usb_interface_descriptor dfu_iface = {
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = 0,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 0,
+    .bInterfaceClass = 0xFE,                   /* Application specific */
+    .bInterfaceSubClass = 1,                   /* Device firmware upgrade */
+    .bInterfaceProtocol = 2,                   /* Dfu mode */
+    .iInterface = 4,
+    .extra = &dfu_function,
+    .extralen = sizeof(dfu_function),
+};
+
+const struct usb_interface ifaces[] = {{
+    .num_altsetting = 1,
+    .altsetting = &dfu_iface,
+}};
+
+const struct usb_config_descriptor config = {
+    .bLength = USB_DT_CONFIGURATION_SIZE,
+    .bDescriptorType = USB_DT_CONFIGURATION,
+    .wTotalLength = 0,
+    .bNumInterfaces = 1,
+    .bConfigurationValue = 1,
+    .iConfiguration = 0,
+    .bmAttributes = 0x80,
+    .bMaxPower = 0x32,
+    .interface = ifaces,
+};
+
+static const char *dfu_strings[] = {
+    "dijkstra.xyz",
+    "Orochi bootloader",
+    OROCHI_VERSION,
+    "Firmware @0x08002000",
+};
+
+/*
+ * Firmware is valid when its stack pointer points into ram and the crc
+ * over the image matches the one stored in its last word.
+ */
+static bool
+boot_app_valid(void)
+{
+    uint32_t sp = *(volatile uint32_t *)BOOT_APP_BASE;
+    uint32_t crc;
+
+    if ((sp & 0x2FFE0000) != 0x20000000) {
+        return false;
+    }
+
+    rcc_periph_clock_enable(RCC_CRC);
+    crc_reset();
+    crc = crc_calculate_block((uint32_t *)BOOT_APP_BASE,
+                              (BOOT_APP_CRC - BOOT_APP_BASE) >> 2);
+
+    return (crc == *(volatile uint32_t *)BOOT_APP_CRC);
+}
+
+static bool
+boot_dfu_requested(void)
+{
+    bool requested;
+
+    rcc_periph_clock_enable(RCC_PWR);
+    rcc_periph_clock_enable(RCC_BKP);
+
+    requested = (BKP_DR1 == BOOT_MAGIC_DFU);
+    if (requested) {
+        pwr_disable_backup_domain_write_protect();
+        BKP_DR1 = 0;
+        pwr_enable_backup_domain_write_protect();
+    }
+
+    return requested;
+}
+
+static void
+boot_app(void)
+{
+    SCB_VTOR = BOOT_APP_BASE;
+    __asm__ volatile ("msr msp, %0" : : "r" (*(volatile uint32_t *)BOOT_APP_BASE));
+    (*(void (**)(void))(BOOT_APP_BASE + 4))();
+}
+
+/*
+ * Write one received block. Blocks are numbered from the start of the
+ * firmware region; anything that would spill into configuration flash is
+ * refused.
+ */
+static enum dfu_status
+dfu_program(void)
+{
+    uint32_t addr = BOOT_APP_BASE + ((uint32_t)prog.blocknum * DFU_TRANSFER_SIZE);
+    uint32_t i;
+
+    if ((addr + prog.len) > BOOT_APP_END) {
+        return DFU_STATUS_ERR_ADDRESS;
+    }
+
+    flash_unlock();
+    for (i = 0; i < prog.len; i += 4) {
+        if (((addr + i) % DFU_PAGE_SIZE) == 0) {
+            flash_erase_page(addr + i);
+            if (flash_get_status_flags() != FLASH_SR_EOP) {
+                flash_lock();
+                return DFU_STATUS_ERR_ERASE;
+            }
+        }
+        flash_program_word(addr + i, *(uint32_t *)(prog.buf + i));
+        if (flash_get_status_flags() != FLASH_SR_EOP) {
+            flash_lock();
+            return DFU_STATUS_ERR_PROG;
+        }
+    }
+    flash_lock();
+
+    return DFU_STATUS_OK;
+}
+
+static uint8_t
+dfu_getstatus(uint32_t *bwPollTimeout)
+{
+    switch (dfu_state) {
+        case STATE_DFU_DNLOAD_SYNC:
+            dfu_state = STATE_DFU_DNBUSY;
+            *bwPollTimeout = 100;
+            break;
+
+        case STATE_DFU_MANIFEST_SYNC:
+            dfu_state = STATE_DFU_MANIFEST;
+            break;
+
+        default:
+            break;
+    }
+    return dfu_status;
+}
+
+static void
+dfu_getstatus_complete(usbd_device *dev, struct usb_setup_data *req)
+{
+    (void)dev;
+    (void)req;
+
+    switch (dfu_state) {
+        case STATE_DFU_DNBUSY:
+            dfu_status = dfu_program();
+            dfu_state = (dfu_status == DFU_STATUS_OK) ? STATE_DFU_DNLOAD_IDLE : STATE_DFU_ERROR;
+            break;
+
+        case STATE_DFU_MANIFEST:
+            if (boot_app_valid()) {
+                dfu_state = STATE_DFU_MANIFEST_WAIT_RESET;
+                scb_reset_system();
+            } else {
+                /* Stay in dfu mode for another attempt */
+                dfu_status = DFU_STATUS_ERR_VERIFY;
+                dfu_state = STATE_DFU_ERROR;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static enum usbd_request_return_codes
+dfu_control_request(usbd_device *dev, struct usb_setup_data *req, uint8_t **buf,
+                    uint16_t *len, void (**complete)(usbd_device *dev, struct usb_setup_data *req))
+{
+    uint32_t bwPollTimeout = 0;
+
+    (void)dev;
+
+    switch (req->bRequest) {
+        case DFU_DNLOAD:
+            if ((len == NULL) || (*len == 0)) {
+                dfu_state = STATE_DFU_MANIFEST_SYNC;
+            } else if (*len > sizeof(prog.buf)) {
+                dfu_status = DFU_STATUS_ERR_ADDRESS;
+                dfu_state = STATE_DFU_ERROR;
+            } else {
+                prog.blocknum = req->wValue;
+                prog.len = *len;
+                memcpy(prog.buf, *buf, *len);
+                dfu_state = STATE_DFU_DNLOAD_SYNC;
+            }
+            return USBD_REQ_HANDLED;
+
+        case DFU_CLRSTATUS:
+            if (dfu_state == STATE_DFU_ERROR) {
+                dfu_status = DFU_STATUS_OK;
+                dfu_state = STATE_DFU_IDLE;
+            }
+            return USBD_REQ_HANDLED;
+
+        case DFU_ABORT:
+            dfu_state = STATE_DFU_IDLE;
+            return USBD_REQ_HANDLED;
+
+        case DFU_GETSTATUS:
+            (*buf)[0] = dfu_getstatus(&bwPollTimeout);
+            (*buf)[1] = bwPollTimeout & 0xFF;
+            (*buf)[2] = (bwPollTimeout >> 8) & 0xFF;
+            (*buf)[3] = (bwPollTimeout >> 16) & 0xFF;
+            (*buf)[4] = dfu_state;
+            (*buf)[5] = 0;
+            *len = 6;
+            *complete = dfu_getstatus_complete;
+            return USBD_REQ_HANDLED;
+
+        case DFU_GETSTATE:
+            (*buf)[0] = dfu_state;
+            *len = 1;
+            return USBD_REQ_HANDLED;
+    }
+
+    return USBD_REQ_NOTSUPP;
+}
+
+static void
+dfu_set_config(usbd_device *dev, uint16_t wValue)
+{
+    (void)wValue;
+
+    usbd_register_control_callback(dev,
+                                   USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+                                   USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+                                   dfu_control_request);
+}
+
+int
+main(void)
+{
+    volatile uint32_t i;
+
+    if ((! boot_dfu_requested()) && boot_app_valid()) {
+        boot_app();
+    }
+
+    rcc_clock_setup_pll(&rcc_hse_configs[RCC_CLOCK_HSE8_72MHZ]);
+
+    /* Pull DP low for a while so the host notices a new device */
+    rcc_periph_clock_enable(USB_RCC);
+    gpio_set_mode(USB_GPIO, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, USB_BV);
+    gpio_clear(USB_GPIO, USB_BV);
+    for (i = 0; i < 800000; i++);
+
+    usbd_dev = usbd_init(&st_usbfs_v1_usb_driver,
+                         &dev_descriptor,
+                         &config,
+                         dfu_strings, 4,
+                         usbd_control_buffer, sizeof(usbd_control_buffer));
+    usbd_register_set_config_callback(usbd_dev, dfu_set_config);
+
+    gpio_set_mode(USB_GPIO, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, USB_BV);
+
+    while (1) {
+        usbd_poll(usbd_dev);
+    }
+}
@@ -28,7 +28,8 @@
 /*
  * clock
  *
- * Millisecond system clock that counts up incrementally.
+ * Millisecond system clock that counts up incrementally. Microseconds are
+ * interpolated from the systick counter.
  */
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/cm3/systick.h>
@@ -60,6 +61,22 @@ clock_now(void)
     return system_ms;
 }
 
+/*
+ * Wraps every 71 minutes; good enough to order and space log records
+ */
+uint32_t
+clock_now_us(void)
+{
+    uint32_t ms, ticks;
+
+    do {
+        ms = system_ms;
+        ticks = STK_RVR - STK_CVR;
+    } while (ms != system_ms);
+
+    return (ms * 1000) + (ticks / (rcc_ahb_frequency / 1000000));
+}
+
 uint32_t
 timer_set(uint32_t delay)
 {
@@ -33,6 +33,7 @@
 
 void clock_init(void);
 uint32_t clock_now(void);
+uint32_t clock_now_us(void);
 uint32_t timer_set(uint32_t delay);
 bool timer_passed(uint32_t timer);
 
@@ -25,10 +25,16 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stddef.h>
+
+#include "automouse.h"
+#include "boot.h"
 #include "command.h"
 #include "config.h"
+#include "dump.h"
 #include "elog.h"
 #include "flash.h"
+#include "frame.h"
 #include "keyboard.h"
 #include "keymap.h"
 #include "light.h"
@@ -38,8 +44,13 @@
 #include "rgbease.h"
 #include "rotary.h"
 #include "serial.h"
+#include "stage.h"
+#include "state.h"
+#include "type.h"
 #include "usb.h"
 
+#define ELOG_MODULE ELOG_COMMAND
+
 static uint8_t
 hex_digit(uint8_t in)
 {
@@ -55,21 +66,65 @@ hex_digit(uint8_t in)
     return 0;
 }
 
+/*
+ * Commands arrive either as a text line, with arguments as hex digits, or
+ * as a binary frame, with arguments as plain bytes. Running short of
+ * arguments is remembered, so a frame can be refused.
+ */
+static bool command_binary = false;
+static bool command_short = false;
+
+/* Tag of the line being executed, or -1; kept while a dump interrupts it */
+static int16_t command_tag = -1;
+
 static uint8_t
-read_hex_8(struct ring *input_ring)
+read_8(struct ring *input_ring)
 {
     uint8_t c;
     uint16_t result = 0;
 
+    if (ring_read_ch(input_ring, &c) == -1) {
+        command_short = true;
+        return 0;
+    }
+    if (command_binary) {
+        return c;
+    }
+
+    result = hex_digit(c) << 4;
     if (ring_read_ch(input_ring, &c) != -1) {
-        result = hex_digit(c) << 4;
-        if (ring_read_ch(input_ring, &c) != -1) {
-            result |= hex_digit(c);
-        }
+        result |= hex_digit(c);
+    } else {
+        command_short = true;
     }
     return result;
 }
 
+static uint16_t
+read_16(struct ring *input_ring)
+{
+    uint16_t result = read_8(input_ring) << 8;
+
+    return result | read_8(input_ring);
+}
+
+static void
+read_event(struct ring *input_ring, event_t *event)
+{
+    event->type = read_8(input_ring);
+    event->args.num1 = read_8(input_ring);
+    event->args.num2 = read_8(input_ring);
+    event->args.num3 = read_8(input_ring);
+}
+
+static void
+read_hsv(struct ring *input_ring, hsv_t *color)
+{
+    color->h = read_16(input_ring);
+    color->s = read_8(input_ring);
+    color->v = read_8(input_ring);
+}
+
 static void
 command_identify(void)
 {
@@ -89,9 +144,9 @@ command_set_backcolor(struct ring *input_ring)
 
     for (n = RGB_BACKLIGHT_OFFSET; n < RGB_ALL_NUM; n++) {
         rgbease_set(n, dummy, F_OVERRIDE, 0, 0);
-        red = read_hex_8(input_ring);
-        green = read_hex_8(input_ring);
-        blue = read_hex_8(input_ring);
+        red = read_8(input_ring);
+        green = read_8(input_ring);
+        blue = read_8(input_ring);
         rgbpixel_set(n, red, green, blue);
     }
 }
@@ -108,9 +163,9 @@ command_set_color(struct ring *input_ring)
             n = key2led(r, c);
 
             rgbease_set(n, dummy, F_OVERRIDE, 0, 0);
-            red = read_hex_8(input_ring);
-            green = read_hex_8(input_ring);
-            blue = read_hex_8(input_ring);
+            red = read_8(input_ring);
+            green = read_8(input_ring);
+            blue = read_8(input_ring);
             rgbpixel_set(n, red, green, blue);
         }
     }
@@ -121,8 +176,8 @@ command_set_light_desktop(struct ring* input_ring)
 {
     uint8_t adisplay, ascreen;
 
-    ascreen  = read_hex_8(input_ring);
-    adisplay = read_hex_8(input_ring);
+    ascreen  = read_8(input_ring);
+    adisplay = read_8(input_ring);
 
     light_set_desktop(ascreen, adisplay);
 }
@@ -130,7 +185,7 @@ command_set_light_desktop(struct ring* input_ring)
 static void
 command_set_light_mic_mute(struct ring* input_ring)
 {
-    uint8_t astate = read_hex_8(input_ring);
+    uint8_t astate = read_8(input_ring);
 
     light_set_mic_mute(astate);
 }
@@ -138,7 +193,7 @@ command_set_light_mic_mute(struct ring* input_ring)
 static void
 command_set_light_mute(struct ring* input_ring)
 {
-    uint8_t astate = read_hex_8(input_ring);
+    uint8_t astate = read_8(input_ring);
 
     light_set_mute(astate);
 }
@@ -146,8 +201,7 @@ command_set_light_mute(struct ring* input_ring)
 static void
 command_set_light_volume(struct ring* input_ring)
 {
-    uint16_t avolume = ((read_hex_8(input_ring) << 8) |
-                        read_hex_8(input_ring));
+    uint16_t avolume = read_16(input_ring);
 
     light_set_volume(avolume);
 }
@@ -157,7 +211,7 @@ command_set_intensity(struct ring *input_ring)
 {
     uint8_t aintensity;
 
-    aintensity = read_hex_8(input_ring);
+    aintensity = read_8(input_ring);
 
     rgbintensity = (fract8_t)aintensity;
     light_apply_state(LIGHT_ALL);
@@ -169,14 +223,11 @@ command_set_keymap(struct ring *input_ring)
     uint8_t alayer, arow, acolumn;
     event_t event;
 
-    alayer = read_hex_8(input_ring);
-    arow = read_hex_8(input_ring);
-    acolumn = read_hex_8(input_ring);
+    alayer = read_8(input_ring);
+    arow = read_8(input_ring);
+    acolumn = read_8(input_ring);
 
-    event.type = read_hex_8(input_ring);
-    event.args.num1 = read_hex_8(input_ring);
-    event.args.num2 = read_hex_8(input_ring);
-    event.args.num3 = read_hex_8(input_ring);
+    read_event(input_ring, &event);
 
     keymap_set(alayer, arow, acolumn, &event);
 }
@@ -186,9 +237,9 @@ command_set_light(struct ring *input_ring)
 {
     uint8_t alayer, arow, acolumn, avalue;
 
-    alayer = read_hex_8(input_ring);
-    arow = read_hex_8(input_ring);
-    acolumn = read_hex_8(input_ring);
+    alayer = read_8(input_ring);
+    arow = read_8(input_ring);
+    acolumn = read_8(input_ring);
 
     if (ring_read_ch(input_ring, &avalue) != -1) {
         light_set(alayer, arow, acolumn, avalue);
@@ -198,39 +249,75 @@ command_set_light(struct ring *input_ring)
 static void
 command_set_macro(struct ring *input_ring)
 {
-    uint8_t number = read_hex_8(input_ring);
+    uint8_t number = read_8(input_ring);
     uint8_t buffer[SERIAL_BUF_SIZEIN];
-    uint8_t len = 0;
+    uint16_t len = 0;
     uint8_t c;
 
     while (ring_read_ch(input_ring, &c) != -1) {
-        if ((c == '\n') ||
-            (c == '\r')) {
+        if ((! command_binary) &&
+            ((c == '\n') ||
+             (c == '\r'))) {
             if (len) {
                 macro_set_phrase(number, (uint8_t *)&buffer, len);
                 return;
             } else {
-                elog("macro with empty phrase");
+                elog_error("macro with empty phrase");
             }
        }
 
         buffer[len++] = c;
 
         if (len >= sizeof(buffer)) {
-            elog("macro len exceeds buffer");
+            elog_error("macro len exceeds buffer");
             return;
         }
     }
 
-    elog("macro not closed of with eol");
+    /* A frame carries the phrase up to its end */
+    if (command_binary && len) {
+        macro_set_phrase(number, (uint8_t *)&buffer, len);
+        return;
+    }
+
+    elog_error("macro not closed of with eol");
+}
+
+static void
+command_log(struct ring *input_ring)
+{
+    uint8_t c, amodule, alevel;
+
+    if (ring_read_ch(input_ring, &c) == -1) {
+        command_short = true;
+        return;
+    }
+
+    switch (c) {
+        case LOG_BINARY:
+            elog_binary = true;
+            break;
+
+        case LOG_LEVEL:
+            amodule = read_8(input_ring);
+            alevel = read_8(input_ring);
+            if (! command_short) {
+                elog_level_set(amodule, alevel);
+            }
+            break;
+
+        case LOG_TEXT:
+            elog_binary = false;
+            break;
+    }
 }
 
 static void
 command_set_nkro(struct ring *input_ring)
 {
-    uint8_t aenable = read_hex_8(input_ring);
+    uint8_t aenable = read_8(input_ring);
 
-    nkro_active = (aenable & 1);
+    keyboard_set_nkro(aenable & 1);
     printfnl("nkro %d", nkro_active);
 }
 
@@ -240,164 +327,479 @@ command_set_palette(struct ring *input_ring)
     hsv_t color;
     uint8_t anumber;
 
-    anumber = read_hex_8(input_ring);
-    color.h = (read_hex_8(input_ring) << 8) | read_hex_8(input_ring);
-    color.s = read_hex_8(input_ring);
-    color.v = read_hex_8(input_ring);
+    anumber = read_8(input_ring);
+    read_hsv(input_ring, &color);
 
     palette_set(anumber, color);
 }
 
 static void
-command_set_rotary(struct ring *input_ring)
+command_set_pointer(struct ring *input_ring)
 {
-    uint8_t alayer, adirection;
-    event_t event;
+    uint16_t ax, ay;
+    uint8_t abuttons;
 
-    alayer = read_hex_8(input_ring);
-    adirection = read_hex_8(input_ring);
+    ax = read_16(input_ring);
+    ay = read_16(input_ring);
+    abuttons = read_8(input_ring);
 
-    event.type = read_hex_8(input_ring);
-    event.args.num1 = read_hex_8(input_ring);
-    event.args.num2 = read_hex_8(input_ring);
-    event.args.num3 = read_hex_8(input_ring);
+    automouse_pointer(ax, ay, abuttons, true);
+}
 
-    rotary_set(alayer, adirection, &event);
+/*
+ * The snapshot goes out as a frame in binary mode, and as a line of hex
+ * that can be fed back to Qr in text mode
+ */
+static void
+command_state(struct ring *input_ring)
+{
+    uint8_t buf[STATE_SNAPSHOT_MAX];
+    uint8_t c, i, len;
+
+    if (ring_read_ch(input_ring, &c) == -1) {
+        command_short = true;
+        return;
+    }
+
+    switch (c) {
+        case STATE_GET:
+            len = state_snapshot(buf);
+            if (command_binary) {
+                frame_send(CMD_STATE, buf, len);
+            } else {
+                for (i = 0; i < len; i++) {
+                    printf("%02x", buf[i]);
+                }
+                printfnl("");
+            }
+            break;
+
+        case STATE_RESTORE:
+            for (i = 0; i < STATE_RESTORE_SIZE; i++) {
+                buf[i] = read_8(input_ring);
+            }
+            if (! command_short) {
+                state_restore(buf);
+            }
+            break;
+    }
 }
 
-void
-command_process(struct ring *input_ring)
+static void
+command_transaction(struct ring *input_ring)
 {
     uint8_t c;
 
-    while (ring_read_ch(input_ring, &c) != -1) {
-        switch (c) {
-            case CMD_FLASH_CLEAR:
-                flash_clear_config();
-                break;
+    if (ring_read_ch(input_ring, &c) == -1) {
+        command_short = true;
+        return;
+    }
 
-            case CMD_FLASH_LOAD:
-                flash_read_config();
-                break;
+    switch (c) {
+        case TRANSACTION_BEGIN:
+            stage_begin();
+            break;
 
-            case CMD_FLASH_SAVE:
-                flash_write_config();
-                break;
+        case TRANSACTION_COMMIT:
+            stage_commit();
+            break;
 
-            case CMD_IDENTIFY:
-                command_identify();
-                break;
+        case TRANSACTION_ABORT:
+            stage_abort();
+            break;
+    }
+}
 
-            case CMD_BACKCOLOR_SET:
-                command_set_backcolor(input_ring);
-                break;
+/*
+ * The configuration image goes out as frames in binary mode, and as lines
+ * of hex in text mode. It comes back in pieces that each start with their
+ * byte offset in the image.
+ */
+static void
+command_flash_image(struct ring *input_ring)
+{
+    uint8_t buffer[SERIAL_BUF_SIZEIN / 2];
+    uint16_t offset, len;
+    uint8_t c, d;
 
-            case CMD_COLOR_SET:
-                command_set_color(input_ring);
-                break;
+    if (ring_read_ch(input_ring, &c) == -1) {
+        command_short = true;
+        return;
+    }
 
-            case CMD_DUMP:
-                if (ring_read_ch(input_ring, &c) != -1) {
-                    switch (c) {
-                        case DUMP_KEYMAP:
-                            keymap_dump();
-                            break;
+    switch (c) {
+        case FLASH_IMAGE_GET:
+            if (flash_export_start(command_binary)) {
+                if (command_binary) {
+                    dump_start_framed(flash_export);
+                } else {
+                    dump_start(flash_export);
+                }
+            }
+            break;
 
-                        case DUMP_LIGHT:
-                            light_dump();
+        case FLASH_IMAGE_PUT:
+            offset = read_16(input_ring);
+            if (command_short) {
+                return;
+            }
+            do {
+                for (len = 0; len < sizeof(buffer); len++) {
+                    if ((ring_read_ch(input_ring, &c) == -1) ||
+                        ((! command_binary) && ((c == '\n') || (c == '\r')))) {
+                        break;
+                    }
+                    if (! command_binary) {
+                        if (ring_read_ch(input_ring, &d) == -1) {
                             break;
+                        }
+                        c = (hex_digit(c) << 4) | hex_digit(d);
+                    }
+                    buffer[len] = c;
+                }
+                if (! flash_import_put(offset, buffer, len, command_binary)) {
+                    return;
+                }
+                offset += len;
+            } while (len == sizeof(buffer));
+            break;
+    }
+}
 
-                        case DUMP_ROTARY:
-                            rotary_dump();
-                            break;
+/*
+ * Write count consecutive entries of a table, starting at a linear index:
+ * - keymap and lightmap index by (layer * ROWS_NUM + row) * COLS_NUM + column
+ * - rotary indexes by layer * ROTARY_NUM + direction
+ * - palette indexes by color number
+ * Entries have the same format as their single entry commands.
+ */
+static void
+command_write_range(struct ring *input_ring)
+{
+    uint8_t target, astart, acount, avalue;
+    uint16_t i;
+    event_t event;
+    hsv_t color;
 
-                        case DUMP_PALETTE:
-                            palette_dump();
-                            break;
-                    }
+    if (ring_read_ch(input_ring, &target) == -1) {
+        command_short = true;
+        return;
+    }
+    astart = read_8(input_ring);
+    acount = read_8(input_ring);
+
+    for (i = astart; i < (astart + acount); i++) {
+        switch (target) {
+            case DUMP_KEYMAP:
+                read_event(input_ring, &event);
+                if (! command_short) {
+                    keymap_set(i / (ROWS_NUM * COLS_NUM),
+                               (i / COLS_NUM) % ROWS_NUM,
+                               i % COLS_NUM,
+                               &event);
                 }
                 break;
 
-            case CMD_DISPLAY_SET:
-                if (ring_read_ch(input_ring, &c) != -1) {
-                    switch (c) {
-                        case LIGHT_DESKTOP:
-                            command_set_light_desktop(input_ring);
-                            break;
-                        case LIGHT_MIC_MUTE:
-                            command_set_light_mic_mute(input_ring);
-                            break;
-                        case LIGHT_MUTE:
-                            command_set_light_mute(input_ring);
-                            break;
-                        case LIGHT_VOLUME:
-                            command_set_light_volume(input_ring);
-                            break;
-                    }
+            case DUMP_LIGHT:
+                if (ring_read_ch(input_ring, &avalue) == -1) {
+                    command_short = true;
+                } else {
+                    light_set(i / (ROWS_NUM * COLS_NUM),
+                              (i / COLS_NUM) % ROWS_NUM,
+                              i % COLS_NUM,
+                              avalue);
                 }
                 break;
 
-            case CMD_INTENSITY_SET:
-                command_set_intensity(input_ring);
+            case DUMP_ROTARY:
+                read_event(input_ring, &event);
+                if (! command_short) {
+                    rotary_set(i / ROTARY_NUM, i % ROTARY_NUM, &event);
+                }
                 break;
 
-            case CMD_KEYMAP_SET:
-                command_set_keymap(input_ring);
+            case DUMP_PALETTE:
+                read_hsv(input_ring, &color);
+                if (! command_short) {
+                    palette_set(i, color);
+                }
                 break;
 
-            case CMD_LIGHT_SET:
-                command_set_light(input_ring);
-                break;
+            default:
+                elog_error("write range of unknown table");
+                return;
+        }
 
-            case CMD_MACRO_CLEAR:
-                macro_init();
-                break;
+        if (command_short) {
+            elog_error("write range short at %d", i);
+            return;
+        }
+    }
+}
 
-            case CMD_MACRO_SET:
-                command_set_macro(input_ring);
-                break;
+static void
+command_set_rotary(struct ring *input_ring)
+{
+    uint8_t alayer, adirection;
+    event_t event;
 
-            case CMD_NKRO_SET:
-                command_set_nkro(input_ring);
-                break;
+    alayer = read_8(input_ring);
+    adirection = read_8(input_ring);
 
-            case CMD_PALETTE_SET:
-                command_set_palette(input_ring);
-                break;
+    read_event(input_ring, &event);
 
-            case CMD_ROTARY_SET:
-                command_set_rotary(input_ring);
-                break;
+    rotary_set(alayer, adirection, &event);
+}
 
-            case '?':
-                printfnl("commands:");
-                printfnl("i                 - identify");
-                printfnl("dt                - dump type: [l]ight, [k]eymap, [r]otary, [p]alette");
-                printfnl("B[rrggbb]*8       - set color rgb of bottom layer");
-                printfnl("C[rrggbb]*25      - set color rgb of top layer");
-                printfnl("Dt                - tell keyboard about a desktop event");
-                printfnl("Grrcct            - set light: layer, row, column, type");
-                printfnl("Iii               - set backlight / bottom layer intensity");
-                printfnl("Kllrrcctta1a2a3   - set keymap layer, row, column, type, arg1-3");
-                printfnl("A                 - clear all macro keys");
-                printfnl("Mnnstring         - set macro nn with string");
-                printfnl("Nnn               - set nkro");
-                printfnl("Pnnhhhhssvv       - set palette: number, hue, saturation, value");
-                printfnl("Rllddtta1a2a3     - set rotary layer, direction, type, arg1-3");
-                printfnl("L                 - load configuration from flash");
-                printfnl("S                 - write configuration to flash");
-                printfnl("Z                 - erase configuration flash");
-                break;
+static void
+command_dispatch(uint8_t c, struct ring *input_ring)
+{
+    command_short = false;
+
+    switch (c) {
+        case CMD_FLASH_CLEAR:
+            flash_clear_config(command_binary);
+            break;
+
+        case CMD_FLASH_IMAGE:
+            command_flash_image(input_ring);
+            break;
+
+        case CMD_FLASH_LOAD:
+            flash_read_config();
+            break;
+
+        case CMD_FLASH_SAVE:
+            flash_write_config(command_binary);
+            break;
+
+        case CMD_IDENTIFY:
+            command_identify();
+            break;
+
+        case CMD_BACKCOLOR_SET:
+            command_set_backcolor(input_ring);
+            break;
+
+        case CMD_COLOR_SET:
+            command_set_color(input_ring);
+            break;
+
+        case CMD_LOG:
+            command_log(input_ring);
+            break;
+
+        case CMD_DUMP:
+            if (ring_read_ch(input_ring, &c) != -1) {
+                switch (c) {
+                    case DUMP_BENCHMARK:
+                        serial_benchmark();
+                        break;
+
+                    case DUMP_LOG:
+                        dump_start(elog_dump);
+                        break;
+
+                    case DUMP_KEYMAP:
+                        dump_start(keymap_dump);
+                        break;
+
+                    case DUMP_LIGHT:
+                        dump_start(light_dump);
+                        break;
+
+                    case DUMP_ROTARY:
+                        dump_start(rotary_dump);
+                        break;
+
+                    case DUMP_PALETTE:
+                        dump_start(palette_dump);
+                        break;
+
+                    case DUMP_USB:
+                        dump_start(usb_dump);
+                        break;
+                }
+            }
+            break;
+
+        case CMD_DISPLAY_SET:
+            if (ring_read_ch(input_ring, &c) != -1) {
+                switch (c) {
+                    case LIGHT_DESKTOP:
+                        command_set_light_desktop(input_ring);
+                        break;
+                    case LIGHT_MIC_MUTE:
+                        command_set_light_mic_mute(input_ring);
+                        break;
+                    case LIGHT_MUTE:
+                        command_set_light_mute(input_ring);
+                        break;
+                    case LIGHT_VOLUME:
+                        command_set_light_volume(input_ring);
+                        break;
+                }
+            }
+            break;
 
-            case '\n':
-            case '\r':
-                /* remove eols */
-                break;
+        case CMD_INTENSITY_SET:
+            command_set_intensity(input_ring);
+            break;
 
-            default:
-                /* lost sync; process until newline */
-                ring_skip_line(input_ring);
-                break;
+        case CMD_KEYMAP_SET:
+            command_set_keymap(input_ring);
+            break;
+
+        case CMD_LIGHT_SET:
+            command_set_light(input_ring);
+            break;
+
+        case CMD_MACRO_CLEAR:
+            macro_init();
+            break;
+
+        case CMD_MACRO_SET:
+            command_set_macro(input_ring);
+            break;
+
+        case CMD_NKRO_SET:
+            command_set_nkro(input_ring);
+            break;
+
+        case CMD_PALETTE_SET:
+            command_set_palette(input_ring);
+            break;
+
+        case CMD_POINTER_SET:
+            command_set_pointer(input_ring);
+            break;
+
+        case CMD_ROTARY_SET:
+            command_set_rotary(input_ring);
+            break;
+
+        case CMD_STATE:
+            command_state(input_ring);
+            break;
+
+        case CMD_TYPE:
+            if (! type_queue(input_ring, command_binary)) {
+                command_short = true;
+            }
+            break;
+
+        case CMD_TRANSACTION:
+            command_transaction(input_ring);
+            break;
+
+        case CMD_UPDATE:
+            boot_dfu();
+            break;
+
+        case CMD_WRITE_RANGE:
+            command_write_range(input_ring);
+            break;
+
+        case '?':
+            printfnl("commands:");
+            printfnl("@tt<command>      - tag all output of command with tt, end with @tt .");
+            printfnl("i                 - identify");
+            printfnl("dt                - dump type: [l]ight, [k]eymap, [r]otary, [p]alette, [u]sb, [e]log, [b]enchmark");
+            printfnl("B[rrggbb]*8       - set color rgb of bottom layer");
+            printfnl("C[rrggbb]*25      - set color rgb of top layer");
+            printfnl("Dt                - tell keyboard about a desktop event");
+            printfnl("Et                - log as [t]ext or [b]inary records");
+            printfnl("Elmmll            - set log level ll of module mm (ff all)");
+            printfnl("Fg                - get configuration image");
+            printfnl("Fpoooo[image]     - put image bytes at offset oooo; an empty Fp0000 starts");
+            printfnl("Grrcct            - set light: layer, row, column, type");
+            printfnl("Iii               - set backlight / bottom layer intensity");
+            printfnl("Kllrrcctta1a2a3   - set keymap layer, row, column, type, arg1-3");
+            printfnl("A                 - clear all macro keys");
+            printfnl("Mnnstring         - set macro nn with string");
+            printfnl("Nnn               - set nkro");
+            printfnl("Pnnhhhhssvv       - set palette: number, hue, saturation, value");
+            printfnl("Qg                - get state snapshot");
+            printfnl("Qr[state]         - restore state snapshot");
+            printfnl("Rllddtta1a2a3     - set rotary layer, direction, type, arg1-3");
+            printfnl("Xxxxxyyyybb       - move pointer to x, y (0-7fff) and click buttons");
+            printfnl("L                 - load configuration from flash");
+            printfnl("S                 - write configuration to flash");
+            printfnl("Tt                - transaction: [b]egin, [c]ommit, [a]bort");
+            printfnl("U                 - reboot into dfu firmware update");
+            printfnl("Wtssnn[entry]*nn  - write nn entries of table t from index ss");
+            printfnl("Ytext             - type text");
+            printfnl("Z                 - erase configuration flash");
+            break;
+
+        case '\n':
+        case '\r':
+            /* remove eols */
+            break;
+
+        default:
+            /* lost sync; process until newline */
+            ring_skip_line(input_ring);
+            break;
+    }
+}
+
+/*
+ * Execute a line of commands. Returns false when a command started a dump;
+ * call again with the same ring once it is done, to execute the rest.
+ *
+ * Output is only tagged while commands run, so lines that background steps
+ * print later never carry the tag of a line that happened to be executing.
+ */
+bool
+command_process(struct ring *input_ring)
+{
+    uint8_t c;
+
+    serial_tag_set(command_tag);
+
+    while (ring_read_ch(input_ring, &c) != -1) {
+        if (c == CMD_TAG) {
+            /* Tag this line's output, and close it with an end line */
+            command_tag = read_8(input_ring);
+            serial_tag_set(command_tag);
+        } else {
+            command_dispatch(c, input_ring);
+            if (dump_active()) {
+                serial_tag_set(-1);
+                return false;
+            }
         }
     }
+
+    if (command_tag >= 0) {
+        printfnl(".");
+        command_tag = -1;
+    }
+    serial_tag_set(-1);
+
+    return true;
+}
+
+/*
+ * Execute a binary frame; the payload holds the arguments of the command
+ * named by opcode. Returns false when the payload was too short.
+ */
+bool
+command_frame(uint8_t opcode, struct ring *payload)
+{
+    bool complete;
+
+    command_binary = true;
+    command_short = false;
+
+    command_dispatch(opcode, payload);
+
+    complete = ! command_short;
+    command_binary = false;
+
+    /* Ignore whatever the command did not use */
+    while (ring_read_ch(payload, NULL) != -1);
+
+    return complete;
 }
@@ -28,14 +28,19 @@
 #ifndef _COMMAND_H
 #define _COMMAND_H
 
+#include <stdbool.h>
+
 #include "ring.h"
 
 enum {
+    CMD_TAG           = '@',
     CMD_BACKCOLOR_SET = 'B',
     CMD_COLOR_SET     = 'C',
     CMD_DISPLAY_SET   = 'D',
     CMD_DUMP          = 'd',
+    CMD_LOG           = 'E',
     CMD_FLASH_CLEAR   = 'Z',
+    CMD_FLASH_IMAGE   = 'F',
     CMD_FLASH_LOAD    = 'L',
     CMD_FLASH_SAVE    = 'S',
     CMD_IDENTIFY      = 'i',
@@ -46,16 +51,48 @@ enum {
     CMD_MACRO_SET     = 'M',
     CMD_NKRO_SET      = 'N',
     CMD_PALETTE_SET   = 'P',
+    CMD_POINTER_SET   = 'X',
     CMD_ROTARY_SET    = 'R',
+    CMD_STATE         = 'Q',
+    CMD_TRANSACTION   = 'T',
+    CMD_TYPE          = 'Y',
+    CMD_UPDATE        = 'U',
+    CMD_WRITE_RANGE   = 'W',
 };
 
 enum {
+    DUMP_BENCHMARK    = 'b',
+    DUMP_LOG          = 'e',
     DUMP_KEYMAP       = 'k',
     DUMP_LIGHT        = 'g',
     DUMP_PALETTE      = 'p',
     DUMP_ROTARY       = 'r',
+    DUMP_USB          = 'u',
+};
+
+enum {
+    FLASH_IMAGE_GET    = 'g',
+    FLASH_IMAGE_PUT    = 'p',
+};
+
+enum {
+    LOG_BINARY         = 'b',
+    LOG_LEVEL          = 'l',
+    LOG_TEXT           = 't',
+};
+
+enum {
+    STATE_GET          = 'g',
+    STATE_RESTORE      = 'r',
+};
+
+enum {
+    TRANSACTION_ABORT  = 'a',
+    TRANSACTION_BEGIN  = 'b',
+    TRANSACTION_COMMIT = 'c',
 };
 
-void command_process(struct ring *input_ring);
+bool command_process(struct ring *input_ring);
+bool command_frame(uint8_t opcode, struct ring *payload);
 
 #endif /* _COMMAND_H */
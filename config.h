@@ -33,8 +33,11 @@
 #define USB_GPIO              GPIOA
 #define USB_RCC               RCC_GPIOA
 #define USB_BV                (GPIO12)
-#define SERIAL_BUF_SIZEIN     160
+#define SERIAL_BUF_SIZEIN     256
 #define SERIAL_BUF_SIZEOUT    1024
+#define SERIAL_LINE_MAX       96
+#define ELOG_BUF_SIZE         512
+#define TYPE_BUF_SIZE         512
 
 /*
  * Matrix pinout definition:
@@ -64,10 +67,17 @@
  * Debounce, how long does a key need to be down to be pressed
  * Enumerate, how long may enumeration take before reset
  * Ease, how often are the rgbleds updated
+ * Mousekey, how often is mouse key motion sent; also the mouse endpoint
+ * polling interval
+ * Command, how long may serial commands run per main loop iteration
+ * Frame, how long may a binary frame stall before it is dropped
  */
 #define MS_DEBOUNCE           10
 #define MS_ENUMERATE          5000
 #define MS_EASE               1
+#define MS_MOUSEKEY           10
+#define MS_COMMAND            1
+#define MS_FRAME              100
 
 /*
  * Number of layers possible in keymap definition
@@ -75,10 +85,13 @@
 #define LAYERS_NUM            3
 
 /*
- * Number of macro keys, and max len of a macro sequence
+ * Number of macro keys, and max len of a macro sequence. Saved macros are
+ * played from flash; overlay is the number of macros that can be changed
+ * in ram between saves.
  */
 #define MACRO_MAXKEYS         12
 #define MACRO_MAXLEN          32
+#define MACRO_OVERLAY_NUM     4
 
 /*
  * Number of screens to store the current desktop number for.  Should
@@ -96,6 +109,12 @@
 #define FLASH_PAGE_NUM        4
 #define FLASH_PAGE_SIZE       0x400
 
+/*
+ * Words programmed per main loop pass while saving; a word takes about
+ * 100us
+ */
+#define FLASH_STEP_WORDS      8
+
 #define LEDS_GPIO             GPIOB
 #define LEDS_RCC              RCC_GPIOB
 #define LEDS_BV               (GPIO12 | GPIO13 | GPIO14 | GPIO15)
@@ -142,4 +161,10 @@
 #define ROT_BV                (GPIO8 | GPIO9)
 #define ROT_PERIOD            65535
 
+/*
+ * Timer counts per rotary detent. The EC11 has 15 pulses per 30 detents,
+ * and the timer counts on all edges.
+ */
+#define ROT_COUNTS_DETENT     2
+
 #endif /* _CONFIG_H */
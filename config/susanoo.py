@@ -19,6 +19,7 @@ display the current active display and sound mute status.
 
 import contextlib
 import os
+import re
 from asyncio import Event, Queue, TaskGroup, get_event_loop, start_unix_server
 from statistics import mean
 
@@ -29,9 +30,21 @@ from serial_asyncio import open_serial_connection
 SOCKET_NAME = f"/run/user/{os.getuid()}/orochi/socket"
 FIFO_NAME = f"/run/user/{os.getuid()}/orochi/fifo"
 
+# Commands prefixed with @tt have all their output lines prefixed with the
+# same tag, followed by an end line "@tt ."
+TAG_RE = re.compile(rb"^@([0-9a-fA-F]{2})")
+TAG_END = b"."
+TAGS_NUM = 256
+
 
 class Mux:
-    """Mux between a number of terminals and serial"""
+    """Mux between a number of terminals and serial
+
+    Lines from terminals are tagged on their way to the keyboard, so that
+    the response lines can be sent back to the terminal that asked for
+    them. A terminal that tags its own commands gets responses with its
+    own tag and the end line; untagged terminals get plain lines. Lines
+    without a tag, like log messages, go to all terminals."""
 
     def __init__(self, reader, writer, debug=False):
         self.running = True
@@ -40,19 +53,65 @@ class Mux:
         self.debug = debug
         self.serial_out = Queue()
         self.terminals = []
+        self.tags = {}
+        self.next_tag = 0
 
     def terminal_add(self, terminal):
         self.terminals.append(terminal)
         print(f"{len(self.terminals)} clients active")
 
-    async def terminal_line_received(self, line):
+    def tag_allocate(self, terminal, client_tag):
+        for i in range(TAGS_NUM):
+            tag = (self.next_tag + i) % TAGS_NUM
+            if tag not in self.tags:
+                self.tags[tag] = (terminal, client_tag)
+                self.next_tag = (tag + 1) % TAGS_NUM
+                return tag
+        return None
+
+    def tag_line(self, terminal, line):
+        if not line.strip():
+            return line
+        client_tag = None
+        match = TAG_RE.match(line)
+        if match:
+            client_tag = match.group(1)
+            line = line[match.end() :]
+        tag = self.tag_allocate(terminal, client_tag)
+        if tag is None:
+            return line
+        return b"@%02x" % tag + line
+
+    async def terminal_line_received(self, line, terminal=None):
         if self.debug:
             print(line.decode())
+        if terminal is not None:
+            line = self.tag_line(terminal, line)
         await self.serial_out.put(line)
 
+    async def tagged_line_transmit(self, tag, line):
+        terminal, client_tag = self.tags[tag]
+        body = line[4:]
+        if body.rstrip() == TAG_END:
+            del self.tags[tag]
+        if client_tag is not None:
+            line = b"@" + client_tag + b" " + body
+        elif body.rstrip() == TAG_END:
+            return
+        else:
+            line = body
+        try:
+            await terminal.write(line)
+        except Exception:
+            self.terminal_abort(terminal)
+
     async def terminal_line_transmit(self, line):
         if self.debug:
             print(line.decode())
+        match = TAG_RE.match(line)
+        if match and int(match.group(1), 16) in self.tags:
+            await self.tagged_line_transmit(int(match.group(1), 16), line)
+            return
         for t in self.terminals:
             try:
                 await t.write(line)
@@ -62,6 +121,8 @@ class Mux:
     def terminal_abort(self, terminal):
         if terminal in self.terminals:
             self.terminals.remove(terminal)
+        for tag in [k for k, (t, _) in self.tags.items() if t is terminal]:
+            del self.tags[tag]
         if self.debug:
             print(f"{len(self.terminals)} clients active")
 
@@ -104,7 +165,7 @@ class Terminal:
                 self.mux.terminal_abort(self)
                 return
             line = await self.reader.readline()
-            await self.mux.terminal_line_received(line)
+            await self.mux.terminal_line_received(line, self)
 
 
 class NamedPipe:
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Dump
+ *
+ * Dumps are sent a line at a time, whenever the output ring has room for
+ * another one, so they arrive complete whatever their size. A dump ends
+ * with a line "end <bytes>", holding the number of bytes the dump sent;
+ * log lines and other output in between are not counted.
+ */
+
+#include <stddef.h>
+
+#include "config.h"
+#include "dump.h"
+#include "serial.h"
+
+static dump_generator_t dump_generator = NULL;
+static uint16_t dump_index;
+static uint32_t dump_count;
+static int16_t dump_tag;
+static bool dump_framed;
+
+void
+dump_start(dump_generator_t generator)
+{
+    dump_generator = generator;
+    dump_index = 0;
+    dump_count = 0;
+    dump_tag = serial_tag_get();
+    dump_framed = false;
+}
+
+void
+dump_start_framed(dump_generator_t generator)
+{
+    dump_start(generator);
+    dump_framed = true;
+}
+
+bool
+dump_active()
+{
+    return (dump_generator != NULL);
+}
+
+void
+dump_process()
+{
+    uint32_t count;
+    bool more;
+
+    /* Dump lines answer the command that started it */
+    serial_tag_set(dump_tag);
+
+    while (dump_generator &&
+           (serial_output_free() >= SERIAL_LINE_MAX)) {
+        count = serial_output_count();
+        more = dump_generator(dump_index++);
+        dump_count += serial_output_count() - count;
+
+        if (! more) {
+            if (! dump_framed) {
+                printfnl("end %u", dump_count);
+            }
+            dump_generator = NULL;
+        }
+    }
+
+    serial_tag_set(-1);
+}
@@ -25,16 +25,212 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 /*
  * Log module
  *
- * Provide logging output via the serial port
+ * Provide logging output via the serial port, either as formatted text or
+ * as binary records that are formatted on the host.
+ *
+ * Binary records are queued in elog_ring by the caller and sent from the
+ * main loop as FRAME_STX frames with opcode CMD_LOG. The frame payload is the
+ * number of records dropped since the previous frame (2 bytes), followed by
+ * whole records:
+ *
+ * | bytes | description                        |
+ * |-------+------------------------------------|
+ * |     1 | number of arguments n              |
+ * |     4 | address of the struct elog_site    |
+ * |     4 | timestamp in us                    |
+ * |   4*n | arguments as 32 bit words          |
+ *
+ * All numbers are little endian.
  */
+#include <stdarg.h>
+
+#include <libopencm3/cm3/sync.h>
+
 #include "clock.h"
+#include "command.h"
+#include "config.h"
 #include "elog.h"
+#include "frame.h"
+#include "ring.h"
+#include "serial.h"
+
+#define ELOG_RECORD_HEADER 9
+#define ELOG_RECORD_MAX    (ELOG_RECORD_HEADER + (ELOG_ARGS_MAX * 4))
+
+bool elog_binary = false;
+uint8_t elog_level[ELOG_LEVEL_SIZE];
+
+static const char *elog_module_name[ELOG_MODULE_NUM] = {
+    [ELOG_MAIN]      = "main",
+    [ELOG_AUTOMOUSE] = "automouse",
+    [ELOG_BOOT]      = "boot",
+    [ELOG_COMMAND]   = "command",
+    [ELOG_EXTRAKEY]  = "extrakey",
+    [ELOG_FLASH]     = "flash",
+    [ELOG_FRAME]     = "frame",
+    [ELOG_KEYBOARD]  = "keyboard",
+    [ELOG_KEYMAP]    = "keymap",
+    [ELOG_LAYER]     = "layer",
+    [ELOG_LIGHT]     = "light",
+    [ELOG_MACRO]     = "macro",
+    [ELOG_MOUSEKEY]  = "mousekey",
+    [ELOG_PALETTE]   = "palette",
+    [ELOG_ROTARY]    = "rotary",
+    [ELOG_STAGE]     = "stage",
+    [ELOG_USB]       = "usb",
+    [ELOG_STATE]     = "state",
+    [ELOG_TYPE]      = "type",
+};
+
+static struct ring elog_ring;
+static uint8_t elog_buffer[ELOG_BUF_SIZE];
+static volatile uint32_t elog_dropped;
+static uint32_t elog_reported;
+
+void
+elog_init()
+{
+    ring_init(&elog_ring, elog_buffer, sizeof(elog_buffer));
+    elog_level_set(ELOG_MODULE_ALL, ELOG_INFO);
+}
 
 void
-elog_start(const char *name, uint16_t line)
+elog_level_set(uint8_t module, uint8_t level)
 {
-    printf("%08x:%s:%d ", (unsigned int) clock_now(), name, line);
+    uint8_t i;
+
+    if (level > ELOG_DEBUG) {
+        level = ELOG_DEBUG;
+    }
+
+    for (i = 0; i < ELOG_MODULE_NUM; i++) {
+        if ((module == ELOG_MODULE_ALL) || (module == i)) {
+            elog_level[i] = level;
+        }
+    }
+}
+
+/*
+ * Dump generator; the compiled in floor, then a line per module
+ */
+bool
+elog_dump(uint16_t index)
+{
+    if (index > ELOG_MODULE_NUM) {
+        return false;
+    }
+
+    if (index == 0) {
+        printfnl("floor %d", ELOG_FLOOR);
+        return true;
+    }
+
+    index--;
+    printfnl("%02x %d %s", index, elog_level[index], elog_module_name[index]);
+
+    return true;
+}
+
+static void
+elog_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * Count records that never made it out, from any interrupt level
+ */
+static void
+elog_drop(uint32_t records)
+{
+    uint32_t dropped;
+
+    do {
+        dropped = __ldrex(&elog_dropped);
+    } while (__strex(dropped + records, &elog_dropped));
+}
+
+void
+elog_write(const struct elog_site *site, ...)
+{
+    uint8_t record[ELOG_RECORD_MAX];
+    uint8_t nargs = site->nargs;
+    uint16_t len;
+    int32_t pos;
+    va_list va;
+
+    va_start(va, site);
+
+    if (! elog_binary) {
+        serial_log(site->file, site->line, site->fmt, va);
+        va_end(va);
+        return;
+    }
+
+    if (nargs > ELOG_ARGS_MAX) {
+        nargs = ELOG_ARGS_MAX;
+    }
+
+    record[0] = nargs;
+    elog_put32(&record[1], (uint32_t)(uintptr_t)site);
+    elog_put32(&record[5], clock_now_us());
+    for (len = ELOG_RECORD_HEADER; nargs--; len += 4) {
+        elog_put32(&record[len], va_arg(va, uint32_t));
+    }
+    va_end(va);
+
+    pos = ring_reserve(&elog_ring, len);
+    if (pos != -1) {
+        ring_put(&elog_ring, pos, record, len);
+    } else {
+        elog_drop(1);
+    }
+    ring_commit(&elog_ring);
+}
+
+/*
+ * Pack queued records into frames; called from the main loop. Records
+ * stay queued until the output has room for a whole frame, and the drop
+ * count only moves on once a frame carrying it is out.
+ */
+void
+elog_process()
+{
+    uint8_t payload[FRAME_SEND_MAX];
+    uint16_t len, size;
+    uint32_t dropped;
+    uint16_t records;
+    uint8_t nargs;
+
+    while ((! RING_EMPTY(&elog_ring)) &&
+           (serial_output_free() >= (FRAME_SEND_MAX + FRAME_OVERHEAD))) {
+        dropped = elog_dropped - elog_reported;
+        if (dropped > 0xffff) {
+            dropped = 0xffff;
+        }
+        payload[0] = dropped;
+        payload[1] = dropped >> 8;
+        len = 2;
+        records = 0;
+
+        while ((ring_peek_ch(&elog_ring, &nargs) != -1) &&
+               ((size = ELOG_RECORD_HEADER + (nargs * 4)) <= sizeof(payload) - len)) {
+            ring_read(&elog_ring, &payload[len], size);
+            len += size;
+            records++;
+        }
+
+        if (frame_send(CMD_LOG, payload, len)) {
+            elog_reported += dropped;
+        } else {
+            elog_drop(records);
+        }
+    }
 }
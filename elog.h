@@ -25,14 +25,104 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #ifndef _LOG_H
 #define _LOG_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include "flash.h"
 #include "serial.h"
 
-void elog_start(const char *name, uint16_t line);
+/*
+ * Levels; a call site logs when its level is at most the level set for its
+ * module. Calls above ELOG_FLOOR are not compiled in at all, e.g. build with
+ * make ELOG_FLOOR=1 to only keep errors.
+ */
+#define ELOG_NONE  0
+#define ELOG_ERROR 1
+#define ELOG_WARN  2
+#define ELOG_INFO  3
+#define ELOG_DEBUG 4
+
+#ifndef ELOG_FLOOR
+#define ELOG_FLOOR ELOG_DEBUG
+#endif
+
+/*
+ * Modules; every source file that logs defines ELOG_MODULE as one of these.
+ * The numbers are stored in flash, so only add to the end.
+ */
+enum {
+    ELOG_MAIN,
+    ELOG_AUTOMOUSE,
+    ELOG_BOOT,
+    ELOG_COMMAND,
+    ELOG_EXTRAKEY,
+    ELOG_FLASH,
+    ELOG_FRAME,
+    ELOG_KEYBOARD,
+    ELOG_KEYMAP,
+    ELOG_LAYER,
+    ELOG_LIGHT,
+    ELOG_MACRO,
+    ELOG_MOUSEKEY,
+    ELOG_PALETTE,
+    ELOG_ROTARY,
+    ELOG_STAGE,
+    ELOG_USB,
+    ELOG_STATE,
+    ELOG_TYPE,
+    ELOG_MODULE_NUM
+};
+
+#define ELOG_MODULE_ALL  0xff
+#define ELOG_LEVEL_SIZE  FLASH_ALIGNED_SIZE(ELOG_MODULE_NUM)
+
+/*
+ * Every elog call site has a constant descriptor in flash. In binary mode
+ * only its address, a timestamp and the raw arguments are logged; the host
+ * finds the descriptor in the elf file and formats the line, see
+ * util/elogdecode.py.
+ */
+struct elog_site {
+    const char *file;
+    const char *fmt;
+    uint16_t line;
+    uint8_t nargs;
+    uint8_t level;
+    uint8_t module;
+};
+
+#define ELOG_ARGS_MAX 8
+
+#define ELOG_NARGS(...) ELOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define ELOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#define elog_at(lvl, fmt, ...)                                          \
+    do {                                                                \
+        if (((lvl) <= ELOG_FLOOR) &&                                    \
+            ((lvl) <= elog_level[ELOG_MODULE])) {                       \
+            static const struct elog_site elog_site = {                 \
+                __FILE__, fmt, __LINE__, ELOG_NARGS(__VA_ARGS__),       \
+                (lvl), ELOG_MODULE                                      \
+            };                                                          \
+            elog_write(&elog_site, ##__VA_ARGS__);                      \
+        }                                                               \
+    } while (0)
+
+#define elog_error(...) elog_at(ELOG_ERROR, __VA_ARGS__)
+#define elog_warn(...)  elog_at(ELOG_WARN, __VA_ARGS__)
+#define elog(...)       elog_at(ELOG_INFO, __VA_ARGS__)
+#define elog_debug(...) elog_at(ELOG_DEBUG, __VA_ARGS__)
+
+extern bool elog_binary;
+extern uint8_t elog_level[ELOG_LEVEL_SIZE];
 
-#define elog elog_start(__FILE__, __LINE__), printfnl
+void elog_init(void);
+void elog_write(const struct elog_site *site, ...);
+void elog_process(void);
+void elog_level_set(uint8_t module, uint8_t level);
+bool elog_dump(uint16_t index);
 
 #endif /* _LOG_H */
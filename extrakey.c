@@ -35,46 +35,84 @@
 #include "elog.h"
 #include "extrakey.h"
 
+#define ELOG_MODULE ELOG_EXTRAKEY
+
 uint8_t extrakey_idle = 0;
 
-static report_extrakey_t state;
+/*
+ * System and consumer reports share an endpoint, but not their state. A
+ * release of one kind can never clear a press of the other.
+ */
+static report_system_t system_state = { .id = REPORTID_SYSTEM };
+static report_consumer_t consumer_state = { .id = REPORTID_CONSUMER };
+
+report_consumer_t *
+extrakey_consumer_report()
+{
+    return &consumer_state;
+}
 
-report_extrakey_t *
-extrakey_report()
+report_system_t *
+extrakey_system_report()
 {
-    return &state;
+    return &system_state;
 }
 
 void
 extrakey_consumer_event(event_t *event, bool pressed)
 {
-    state.id = REPORTID_CONSUMER;
+    uint16_t code = event->extra.code;
+    uint8_t i;
 
-    elog("extrakey consumer %04x %d", event->extra.code, pressed);
+    elog_debug("extrakey consumer %04x %d", code, pressed);
 
     if (pressed) {
-        state.codel = event->extra.code & 0xff;
-        state.codeh = event->extra.code >> 8;
+        /* Already reported as active, or take the first free slot */
+        for (i = 0; i < CONSUMER_USAGES_NUM; i++) {
+            if (consumer_state.codes[i] == code) {
+                return;
+            }
+        }
+        for (i = 0; i < CONSUMER_USAGES_NUM; i++) {
+            if (consumer_state.codes[i] == 0) {
+                consumer_state.codes[i] = code;
+                break;
+            }
+        }
+        if (i == CONSUMER_USAGES_NUM) {
+            elog_warn("extrakey consumer usages exhausted");
+            return;
+        }
     } else {
-        state.codel = state.codeh = 0;
+        for (i = 0; i < CONSUMER_USAGES_NUM; i++) {
+            if (consumer_state.codes[i] == code) {
+                consumer_state.codes[i] = 0;
+                break;
+            }
+        }
+        if (i == CONSUMER_USAGES_NUM) {
+            return;
+        }
     }
 
-    usb_update_extrakey(&state);
+    usb_update_consumer(&consumer_state);
 }
 
 void
 extrakey_system_event(event_t *event, bool pressed)
 {
-    state.id = REPORTID_SYSTEM;
+    uint16_t code = event->extra.code;
 
-    elog("extrakey system %04x %d", event->extra.code, pressed);
+    elog_debug("extrakey system %04x %d", code, pressed);
 
     if (pressed) {
-        state.codel = event->extra.code & 0xff;
-        state.codeh = event->extra.code >> 8;
+        system_state.code = code;
+    } else if (system_state.code == code) {
+        system_state.code = 0;
     } else {
-        state.codel = state.codeh = 0;
+        /* Release of a system key that was already superseded */
+        return;
     }
 
-    usb_update_extrakey(&state);
+    usb_update_system(&system_state);
 }
@@ -34,7 +34,8 @@
 
 extern uint8_t extrakey_idle;
 
-report_extrakey_t *extrakey_report(void);
+report_consumer_t *extrakey_consumer_report(void);
+report_system_t *extrakey_system_report(void);
 void extrakey_consumer_event(event_t *event, bool pressed);
 void extrakey_system_event(event_t *event, bool pressed);
 
@@ -29,6 +29,19 @@
  * flash
  *
  * User flash used for storing keymaps and macros.
+ *
+ * The configuration is kept as a log of records across the user flash
+ * pages. A record holds a run of entries of one table, e.g. a few keys or
+ * a palette color, or one macro, and ends with a crc. At boot the log is
+ * replayed over the compiled in configuration. A save appends records for
+ * just the entries that differ from what the log holds.
+ *
+ * The pages are split in two slots that each hold a log. When the log of
+ * the active slot is full, the whole configuration is written to the
+ * other slot, checked, and only then is its header written. The header
+ * carries a sequence number; at boot the valid slot with the highest
+ * number is used. Until the new slot is complete the old one stays valid,
+ * so a power loss during a save never loses the configuration.
  */
 
 #include <stdint.h>
@@ -40,226 +53,1397 @@
 #include <libopencm3/stm32/rcc.h>
 
 #include "config.h"
+#include "command.h"
 #include "elog.h"
+#include "flash.h"
+#include "frame.h"
 #include "keyboard.h"
 #include "keymap.h"
 #include "layer.h"
 #include "light.h"
 #include "macro.h"
+#include "map_ascii.h"
 #include "palette.h"
 #include "rgbease.h"
 #include "rotary.h"
+#include "serial.h"
 
-#if MACRO_MAXKEYS % 4
-/* flash reads and writes are in 4 byte increments. While other values
- * will work, they can clobber whatever is allocated right next to
- * macro_len */
-#error MACRO_MAXKEYS must be a multiple of 4
-#endif
+#define ELOG_MODULE ELOG_FLASH
 
-typedef struct {
-    const uint8_t data[FLASH_PAGE_NUM][FLASH_PAGE_SIZE];
-} __attribute__ ((packed)) flashpage_t;
+#define FLASH_LOG_MAGIC       0x31474f4c  /* "LOG1" */
+#define FLASH_IMAGE_MAGIC     0x31474643  /* "CFG1" */
+#define FLASH_IMAGE_READY     2           /* import status once erased */
+#define FLASH_SLOT_NUM        2
+#define FLASH_SLOT_PAGES      (FLASH_PAGE_NUM / FLASH_SLOT_NUM)
+#define FLASH_LOG_LEN         (((FLASH_SLOT_PAGES * FLASH_PAGE_SIZE) >> 2) - 2)
+#define FLASH_ERASED          0xffffffff
+#define FLASH_WORDS(bytes)    (((bytes) + 3) >> 2)
 
+/*
+ * Every record starts with this header word, followed by len bytes of
+ * payload padded to a word, and the crc over header and payload words.
+ * The crc is written last, so a record cut short by a power loss is
+ * skipped when the log is replayed.
+ */
 typedef struct {
-    event_t keymap[LAYERS_NUM][ROWS_NUM][COLS_NUM];
-    event_t rotary[LAYERS_NUM][ROTARY_NUM];
-    event_t macro_buffer[MACRO_MAXKEYS][MACRO_MAXLEN];
-    uint8_t macro_len[MACRO_MAXKEYS];
-    hsv_t palette[PALETTE_NUM];
-    lightmap_t lightmap;
-    uint32_t layer;
-    uint32_t nkro_active;
-    uint32_t rgbintensity;
-} __attribute__ ((packed)) flashdata_t;
+    uint8_t type;
+    uint8_t index;
+    uint16_t len;
+} __attribute__ ((packed)) flashrecord_t;
 
+/*
+ * The magic is programmed last, after the sequence; a slot without it is
+ * unused or was cut short.
+ */
 typedef struct {
-    uint32_t data[sizeof(flashdata_t) >> 2];
-    uint32_t zero[(sizeof(flashpage_t) - sizeof(flashdata_t) - sizeof(uint32_t)) >> 2];
-    uint32_t crc;
-} __attribute__ ((packed, aligned(4))) flashcrc_t;
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t log[FLASH_LOG_LEN];
+} __attribute__ ((packed, aligned(4))) flashslot_t;
 
-typedef union {
-    flashpage_t page;
-    flashdata_t data;
-    flashcrc_t crc;
+typedef struct {
+    flashslot_t slot[FLASH_SLOT_NUM];
 } __attribute__ ((packed, aligned(4))) flash_t;
 
 flash_t flash __attribute__ ((section(".userflash")));
 
+/* The active slot, NULL if there is none, and the end of its log */
+static flashslot_t *flash_slot;
+static uint16_t flash_end;
+
+/*
+ * The tables that make up the configuration. A record of a table holds
+ * entries index up to index + len / size; a macro record holds one macro,
+ * which is played from the record itself.
+ * Types are stored in flash, so only add to the end.
+ */
+enum {
+    FLASH_KEYMAP = 1,
+    FLASH_ROTARY,
+    FLASH_MACRO,
+    FLASH_PALETTE,
+    FLASH_LIGHTMAP,
+    FLASH_SETTINGS,
+    FLASH_ELOG,
+};
+
+enum {
+    FLASH_SETTING_LAYER,
+    FLASH_SETTING_NKRO,
+    FLASH_SETTING_INTENSITY,
+    FLASH_SETTING_NUM
+};
+
+static uint8_t flash_settings[FLASH_SETTING_NUM];
+
+struct flash_table {
+    uint8_t type;
+    uint8_t size;
+    uint8_t num;
+    void *data;
+};
+
+static const struct flash_table flash_tables[] = {
+    { FLASH_KEYMAP,   sizeof(event_t), LAYERS_NUM * ROWS_NUM * COLS_NUM, keymap },
+    { FLASH_ROTARY,   sizeof(event_t), LAYERS_NUM * ROTARY_NUM,          rotary },
+    { FLASH_MACRO,    sizeof(event_t), MACRO_MAXKEYS,                    NULL },
+    { FLASH_PALETTE,  sizeof(hsv_t),   PALETTE_NUM,                      palette },
+    { FLASH_LIGHTMAP, 1,               _LIGHTMAP_SIZE,                   lightmap.data },
+    { FLASH_SETTINGS, 1,               FLASH_SETTING_NUM,                flash_settings },
+    { FLASH_ELOG,     1,               ELOG_MODULE_NUM,                  elog_level },
+};
+
+#define FLASH_TABLE_NUM       (sizeof(flash_tables) / sizeof(flash_tables[0]))
+#define FLASH_ENTRY_MAX       _LIGHTMAP_SIZE
+
+/*
+ * Per table entry, whether the log holds its current value
+ */
+typedef uint8_t flash_saved_t[FLASH_TABLE_NUM][(FLASH_ENTRY_MAX + 7) >> 3];
+
+void
+crc_init()
+{
+    rcc_periph_clock_enable(RCC_CRC);
+}
+
+static void
+flash_settings_get(void)
+{
+    flash_settings[FLASH_SETTING_LAYER] = layer;
+    flash_settings[FLASH_SETTING_NKRO] = nkro_active;
+    flash_settings[FLASH_SETTING_INTENSITY] = rgbintensity;
+}
+
+static void
+flash_settings_set(void)
+{
+    layer_set(flash_settings[FLASH_SETTING_LAYER]);
+    keyboard_set_nkro(flash_settings[FLASH_SETTING_NKRO]);
+    rgbintensity = flash_settings[FLASH_SETTING_INTENSITY];
+}
+
+static const struct flash_table *
+flash_table(uint8_t type)
+{
+    uint8_t i;
+
+    for (i = 0; i < FLASH_TABLE_NUM; i++) {
+        if (flash_tables[i].type == type) {
+            return &flash_tables[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Where the entries of a record live in ram, or NULL if the record does
+ * not fit its table
+ */
+static uint8_t *
+flash_entry(const struct flash_table *table, uint8_t index, uint16_t len)
+{
+    if ((table->data == NULL) ||
+        (len % table->size) ||
+        ((index + (len / table->size)) > table->num)) {
+        return NULL;
+    }
+    return (uint8_t *)table->data + (index * table->size);
+}
+
 static uint32_t
-flash_crc()
+flash_record_crc(const uint32_t *record, uint16_t words)
 {
-    uint32_t result;
+    uint32_t crc = 0;
 
     crc_reset();
-    result = crc_calculate_block(&flash.crc.data[0], sizeof(flash.crc.data) >> 2);
-    elog("crc %08x", result);
-    return result;
+    while (words--) {
+        crc = crc_calculate(*record++);
+    }
+    return crc;
 }
 
-static uint8_t
-flash_crc_check()
+/*
+ * Records can be packed, which is marked by FLASH_PACKED in their type and
+ * len then counts the packed bytes. A packed macro is stored as macro.h
+ * describes. Packed table entries come after a control byte:
+ *
+ *   0nnnnnnn            n + 1 entries follow
+ *   10nnnnnn <entry>    the entry n + 2 times
+ *   11nnnnnn            entry n of this record once more
+ *
+ * A run is only packed when that makes it smaller.
+ */
+#define FLASH_PACKED          0x80
+#define FLASH_PACK_REPEAT     0x80
+#define FLASH_PACK_COPY       0xc0
+#define FLASH_PACK_ARG        0x3f
+#define FLASH_PACK_LITERALS   0x80
+#define FLASH_RAW_MAX         (LAYERS_NUM * ROWS_NUM * COLS_NUM * sizeof(event_t))
+
+struct flash_pack {
+    uint8_t *data;
+    uint16_t len;
+};
+
+/*
+ * Append to the packed data; with no data only count
+ */
+static void
+flash_pack_put(struct flash_pack *pack, const uint8_t *data, uint16_t len)
 {
-    uint32_t stored_crc = flash.crc.crc;
-    uint32_t calced_crc = flash_crc();
+    if (pack->data && ((pack->len + len) <= FLASH_RAW_MAX)) {
+        memcpy(pack->data + pack->len, data, len);
+    }
+    pack->len += len;
+}
 
-    return (stored_crc == calced_crc);
+static void
+flash_pack_literals(struct flash_pack *pack, const uint8_t *entry, uint8_t count, uint8_t size)
+{
+    uint8_t control;
+
+    while (count) {
+        control = (count > FLASH_PACK_LITERALS) ? FLASH_PACK_LITERALS : count;
+        count -= control;
+        flash_pack_put(pack, &(uint8_t){ control - 1 }, 1);
+        flash_pack_put(pack, entry, control * size);
+        entry += control * size;
+    }
 }
 
-void
-crc_init()
+/*
+ * The events of a macro, packed or as they are, into data or just counted
+ * if data is NULL. Returns the length.
+ */
+static uint16_t
+flash_pack_macro(uint8_t key, uint8_t *data, bool packed)
 {
-    rcc_periph_clock_enable(RCC_CRC);
+    struct flash_pack pack = { data, 0 };
+    event_t event;
+    uint8_t i;
+    int16_t c;
+
+    for (i = 0; macro_get_event(key, i, &event); i++) {
+        c = packed ? map_ascii_from_event(&event) : -1;
+        if (c < 0) {
+            if (packed) {
+                flash_pack_put(&pack, &(uint8_t){ MACRO_ESCAPE }, 1);
+            }
+            flash_pack_put(&pack, (const uint8_t *)&event, sizeof(event));
+        } else {
+            flash_pack_put(&pack, &(uint8_t){ c }, 1);
+        }
+    }
+
+    return pack.len;
 }
 
-static uint32_t
-flash_erase()
+/*
+ * Pack len bytes of table entries from index on into data, or just count
+ * them if data is NULL. Returns the packed length.
+ */
+static uint16_t
+flash_pack(const struct flash_table *table, uint8_t index, uint16_t len, uint8_t *data)
 {
-    uint32_t i;
-    uint32_t status;
+    struct flash_pack pack = { data, 0 };
+    const uint8_t *entry;
+    uint8_t size = table->size;
+    uint8_t count = len / size;
+    uint8_t i, j, n, literal;
 
-    elog("erasing flash");
-    flash_clear_status_flags();
-    flash_unlock();
+    if (table->type == FLASH_MACRO) {
+        return flash_pack_macro(index, data, true);
+    }
 
-    for (i = 0; i < FLASH_PAGE_NUM; i++) {
-        flash_erase_page((uint32_t)&flash.page.data[i]);
-        status = flash_get_status_flags();
-        if (status != FLASH_SR_EOP) {
-            elog("page erase %d: status error %02x", i, status);
-            return 0;
+    entry = flash_entry(table, index, len);
+
+    for (i = 0, literal = 0; i < count; i += n) {
+        for (n = 1; ((i + n) < count) && (n < (FLASH_PACK_ARG + 2)) &&
+                 ! memcmp(entry + (i * size), entry + ((i + n) * size), size); n++)
+            ;
+
+        if (n > 1) {
+            flash_pack_literals(&pack, entry + (literal * size), i - literal, size);
+            flash_pack_put(&pack, &(uint8_t){ FLASH_PACK_REPEAT | (n - 2) }, 1);
+            flash_pack_put(&pack, entry + (i * size), size);
+            literal = i + n;
+            continue;
+        }
+
+        for (j = 0; (size > 1) && (j < i) && (j <= FLASH_PACK_ARG); j++) {
+            if (! memcmp(entry + (j * size), entry + (i * size), size)) {
+                break;
+            }
+        }
+
+        if ((size > 1) && (j < i) && (j <= FLASH_PACK_ARG)) {
+            flash_pack_literals(&pack, entry + (literal * size), i - literal, size);
+            flash_pack_put(&pack, &(uint8_t){ FLASH_PACK_COPY | j }, 1);
+            literal = i + 1;
         }
     }
+    flash_pack_literals(&pack, entry + (literal * size), count - literal, size);
 
-    return 1;
+    return pack.len;
+}
+
+/*
+ * Unpack a table record into at most FLASH_RAW_MAX bytes of data. Returns
+ * the unpacked length, or -1 if the record is damaged.
+ */
+static int16_t
+flash_unpack(const struct flash_table *table, const uint8_t *packed, uint16_t len, uint8_t *data)
+{
+    uint8_t size = table->size;
+    uint16_t pos = 0, out = 0;
+    uint8_t c, n;
+
+    while (pos < len) {
+        c = packed[pos++];
+
+        if (! (c & FLASH_PACK_REPEAT)) {
+            n = c + 1;
+            if (((pos + (n * size)) > len) || ((out + (n * size)) > FLASH_RAW_MAX)) {
+                return -1;
+            }
+            memcpy(data + out, packed + pos, n * size);
+            pos += n * size;
+            out += n * size;
+        } else if ((c & FLASH_PACK_COPY) == FLASH_PACK_COPY) {
+            n = c & FLASH_PACK_ARG;
+            if ((((n + 1) * size) > out) || ((out + size) > FLASH_RAW_MAX)) {
+                return -1;
+            }
+            memcpy(data + out, data + (n * size), size);
+            out += size;
+        } else {
+            n = (c & FLASH_PACK_ARG) + 2;
+            if (((pos + size) > len) || ((out + (n * size)) > FLASH_RAW_MAX)) {
+                return -1;
+            }
+            while (n--) {
+                memcpy(data + out, packed + pos, size);
+                out += size;
+            }
+            pos += size;
+        }
+    }
+
+    return out;
+}
+
+/*
+ * Call fn for every intact record in the log of a slot, packed table
+ * records unpacked; macros stay as they are stored. Returns the word
+ * offset of the end of the log; a header that runs past the slot fills it
+ * up.
+ */
+typedef void (*flash_record_fn_t)(const flashrecord_t *record, const uint8_t *payload,
+                                  void *arg);
+
+static uint16_t
+flash_log_walk(const flashslot_t *slot, flash_record_fn_t fn, void *arg)
+{
+    const struct flash_table *table;
+    const flashrecord_t *record;
+    flashrecord_t unpacked;
+    uint8_t data[FLASH_RAW_MAX];
+    uint16_t pos = 0;
+    uint16_t words;
+    int16_t len;
+
+    while ((pos < FLASH_LOG_LEN) && (slot->log[pos] != FLASH_ERASED)) {
+        record = (const flashrecord_t *)&slot->log[pos];
+        words = 1 + FLASH_WORDS(record->len);
+
+        if ((pos + words + 1) > FLASH_LOG_LEN) {
+            elog_warn("record at %d runs past the log", pos);
+            return FLASH_LOG_LEN;
+        }
+
+        if (flash_record_crc(&slot->log[pos], words) != slot->log[pos + words]) {
+            elog_warn("record at %d has a bad crc", pos);
+        } else if (! (record->type & FLASH_PACKED) ||
+                   ((record->type & ~FLASH_PACKED) == FLASH_MACRO)) {
+            fn(record, (const uint8_t *)&slot->log[pos + 1], arg);
+        } else if (((table = flash_table(record->type & ~FLASH_PACKED)) == NULL) ||
+                   ((len = flash_unpack(table, (const uint8_t *)&slot->log[pos + 1],
+                                        record->len, data)) < 0)) {
+            elog_warn("record at %d does not unpack", pos);
+        } else {
+            unpacked.type = table->type;
+            unpacked.index = record->index;
+            unpacked.len = len;
+            fn(&unpacked, data, arg);
+        }
+        pos += words + 1;
+    }
+
+    return pos;
+}
+
+/*
+ * The valid slot with the highest sequence; only the headers are read
+ */
+static flashslot_t *
+flash_slot_select(void)
+{
+    flashslot_t *slot = NULL;
+    uint8_t i;
+
+    for (i = 0; i < FLASH_SLOT_NUM; i++) {
+        if ((flash.slot[i].magic == FLASH_LOG_MAGIC) &&
+            ((slot == NULL) || (flash.slot[i].sequence > slot->sequence))) {
+            slot = &flash.slot[i];
+        }
+    }
+
+    return slot;
+}
+
+static void
+flash_apply(const flashrecord_t *record, const uint8_t *payload, void *arg)
+{
+    const struct flash_table *table = flash_table(record->type & ~FLASH_PACKED);
+    uint8_t *entry;
+
+    (void)arg;
+
+    if ((table != NULL) && (table->type == FLASH_MACRO)) {
+        if ((record->len > UINT8_MAX) ||
+            ! macro_set_stored(record->index, payload, record->len,
+                               record->type & FLASH_PACKED)) {
+            elog_warn("macro %d does not fit", record->index);
+        }
+        return;
+    }
+
+    if ((table == NULL) ||
+        ((entry = flash_entry(table, record->index, record->len)) == NULL)) {
+        elog_warn("record %d %d does not fit", record->type, record->index);
+        return;
+    }
+
+    cm_disable_interrupts();
+    memcpy(entry, payload, record->len);
+    cm_enable_interrupts();
+}
+
+/*
+ * After a save, play macros from their new records; frees their overlay
+ */
+static void
+flash_attach(const flashrecord_t *record, const uint8_t *payload, void *arg)
+{
+    bool packed = record->type & FLASH_PACKED;
+
+    (void)arg;
+
+    if (((record->type & ~FLASH_PACKED) == FLASH_MACRO) &&
+        (record->len <= UINT8_MAX) &&
+        macro_is_stored(record->index, payload, record->len, packed)) {
+        macro_set_stored(record->index, payload, record->len, packed);
+    }
+}
+
+static void
+flash_saved_set(flash_saved_t saved, uint8_t table, uint8_t index, bool same)
+{
+    if (same) {
+        saved[table][index >> 3] |= (1 << (index & 0x07));
+    } else {
+        saved[table][index >> 3] &= ~(1 << (index & 0x07));
+    }
+}
+
+static bool
+flash_saved_get(flash_saved_t saved, uint8_t table, uint8_t index)
+{
+    return saved[table][index >> 3] & (1 << (index & 0x07));
+}
+
+/*
+ * Later records win, so an entry is saved if the last record that holds
+ * it has its current value
+ */
+static void
+flash_compare(const flashrecord_t *record, const uint8_t *payload, void *arg)
+{
+    const struct flash_table *table = flash_table(record->type & ~FLASH_PACKED);
+    flash_saved_t *saved = arg;
+    uint8_t t, *entry;
+    uint16_t i;
+
+    if (table == NULL) {
+        return;
+    }
+    t = table - flash_tables;
+
+    if (table->type == FLASH_MACRO) {
+        if (record->index < MACRO_MAXKEYS) {
+            flash_saved_set(*saved, t, record->index,
+                            (record->len <= UINT8_MAX) &&
+                            macro_is_stored(record->index, payload, record->len,
+                                            record->type & FLASH_PACKED));
+        }
+        return;
+    }
+
+    if ((entry = flash_entry(table, record->index, record->len)) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < record->len; i += table->size) {
+        flash_saved_set(*saved, t, record->index + (i / table->size),
+                        ! memcmp(entry + i, payload + i, table->size));
+    }
+}
+
+static bool
+flash_check(const char *what, uint32_t where)
+{
+    uint32_t status = flash_get_status_flags();
+
+    if (status != FLASH_SR_EOP) {
+        elog_error("%s %08x: status error %02x", what, where, status);
+        return false;
+    }
+    return true;
+}
+
+static bool
+flash_write_word(volatile uint32_t *dest, uint32_t data)
+{
+    flash_program_word((uint32_t)dest, data);
+    return flash_check("write", (uint32_t)dest);
+}
+
+/*
+ * A run of entries of one table that is not saved yet; a macro is a run
+ * of its own. Size is what the run takes in flash, less than len if it is
+ * packed.
+ */
+struct flash_run {
+    uint8_t table;
+    uint8_t index;
+    uint8_t count;
+    uint16_t len;
+    uint16_t size;
+};
+
+/*
+ * Find the next run from run->table and run->index on. Returns false when
+ * everything is saved.
+ */
+static bool
+flash_run_next(flash_saved_t saved, struct flash_run *run)
+{
+    const struct flash_table *table;
+
+    for (; run->table < FLASH_TABLE_NUM; run->table++, run->index = 0) {
+        table = &flash_tables[run->table];
+
+        for (; run->index < table->num; run->index++) {
+            if (flash_saved_get(saved, run->table, run->index)) {
+                continue;
+            }
+
+            if (table->type == FLASH_MACRO) {
+                run->count = 1;
+                run->len = macros[run->index].len * sizeof(event_t);
+            } else {
+                run->count = 1;
+                while (((run->index + run->count) < table->num) &&
+                       ! flash_saved_get(saved, run->table, run->index + run->count)) {
+                    run->count++;
+                }
+                run->len = run->count * table->size;
+            }
+            run->size = flash_pack(table, run->index, run->len, NULL);
+            if (run->size > run->len) {
+                run->size = run->len;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Words the records for all runs take
+ */
+static uint16_t
+flash_runs_size(flash_saved_t saved)
+{
+    struct flash_run run = { 0 };
+    uint16_t words = 0;
+
+    while (flash_run_next(saved, &run)) {
+        words += 2 + FLASH_WORDS(run.size);
+        run.index += run.count;
+    }
+
+    return words;
+}
+
+/*
+ * Saving runs from the main loop, a bounded amount of work per call: erase
+ * a page, or program up to FLASH_STEP_WORDS words. Records are written
+ * header first and crc last, so a record that is cut short is skipped.
+ *
+ * Changes are appended to the active slot. When they do not fit, the
+ * other slot is erased and gets the whole configuration; once its records
+ * read back intact, the sequence and magic are written and it becomes the
+ * active slot.
+ *
+ * An import goes the same way: its words are programmed into the other
+ * slot as they come in, and once the image crc and the records check out
+ * the slot is made active and loaded.
+ */
+enum {
+    FLASH_SAVE_ERASE,
+    FLASH_SAVE_HEADER,
+    FLASH_SAVE_PAYLOAD,
+    FLASH_SAVE_CRC,
+    FLASH_SAVE_VERIFY,
+    FLASH_SAVE_SEQUENCE,
+    FLASH_SAVE_MAGIC,
+    FLASH_SAVE_IMAGE,
+    FLASH_SAVE_IMAGE_CRC,
+    FLASH_SAVE_LOAD,
+};
+
+bool flash_active = false;
+
+static struct {
+    flash_saved_t saved;
+    struct flash_run run;
+    uint8_t pack[FLASH_RAW_MAX];
+    flashslot_t *slot;
+    uint8_t state;
+    uint8_t page;
+    uint16_t end;
+    uint16_t start;
+    uint16_t done;
+    uint16_t records;
+    bool compact;
+    bool import;
+    bool clear;
+    bool framed;
+} flash_save;
+
+/*
+ * An image being imported into the slot that is not active. Its words are
+ * queued as they come in, and programmed from flash_process; a piece is
+ * at most a frame of payload.
+ */
+#define FLASH_IMPORT_WORDS    ((FRAME_PAYLOAD_MAX + 3) >> 2)
+
+static struct {
+    flashslot_t *slot;
+    uint16_t offset;
+    uint16_t pos;
+    uint16_t words;
+    uint32_t word;
+    uint32_t crc;
+    uint32_t image_crc;
+    uint32_t queue[FLASH_IMPORT_WORDS];
+    uint8_t queued;
+    uint8_t taken;
+} flash_import;
+
+/*
+ * Saved macros are played from the pages; forget them before the pages
+ * are erased or replaced
+ */
+static void
+flash_macros_detach(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MACRO_MAXKEYS; i++) {
+        if ((macros[i].data >= (const uint8_t *)&flash) &&
+            (macros[i].data < (const uint8_t *)(&flash + 1))) {
+            memset(&macros[i], 0, sizeof(macros[i]));
+        }
+    }
 }
 
+/*
+ * Erase both slots; flash_process erases a page per pass. The end is
+ * reported as a line, or as a frame when the clear came in a frame.
+ */
 uint32_t
-flash_clear_config(void)
+flash_clear_config(bool framed)
 {
-    flash_erase();
-    flash_lock();
+    if (flash_active) {
+        elog_warn("flash busy saving");
+        return 0;
+    }
+
+    flash_macros_detach();
+    flash_import.slot = NULL;
+    flash_slot = NULL;
+    flash_end = 0;
+
+    memset(&flash_save, 0, sizeof(flash_save));
+    flash_save.slot = &flash.slot[0];
+    flash_save.state = FLASH_SAVE_ERASE;
+    flash_save.clear = true;
+    flash_save.framed = framed;
+
+    elog("erasing flash");
+    flash_clear_status_flags();
+    flash_unlock();
+    flash_active = true;
     return 1;
 }
 
+/*
+ * The tables as the firmware was built are still in the load image of
+ * .data
+ */
+extern uint8_t _data, _edata, _data_loadaddr;
+
+/*
+ * Put the configuration back to what the firmware was built with, so a
+ * replay of the log gives the saved configuration and nothing else
+ */
+static void
+flash_defaults(void)
+{
+    const struct flash_table *table;
+    uint8_t *data;
+    uint16_t len;
+    uint8_t i;
+
+    for (i = 0; i < FLASH_TABLE_NUM; i++) {
+        table = &flash_tables[i];
+        data = table->data;
+        len = table->num * table->size;
+        if ((data >= &_data) && ((data + len) <= &_edata)) {
+            cm_disable_interrupts();
+            memcpy(data, &_data_loadaddr + (data - &_data), len);
+            cm_enable_interrupts();
+        }
+    }
+
+    memset(&macros, 0, sizeof(macros));
+    flash_settings[FLASH_SETTING_LAYER] = 0;
+    flash_settings[FLASH_SETTING_NKRO] = false;
+    flash_settings[FLASH_SETTING_INTENSITY] = RGB_BACKLIGHT_INTENS;
+    elog_level_set(ELOG_MODULE_ALL, ELOG_INFO);
+}
+
+/*
+ * Load the active slot over the defaults. Interrupts are only held off
+ * while a record is copied into its table.
+ */
 uint32_t
 flash_read_config(void)
 {
     elog("reading configuration");
 
-    if (! flash_crc_check()) {
-        elog("crc not correct");
+    if (flash_active) {
+        elog_warn("flash busy saving");
         return 0;
     }
 
-    cm_disable_interrupts();
-    memcpy(keymap, flash.data.keymap, sizeof(flash.data.keymap));
-    memcpy(rotary, flash.data.rotary, sizeof(flash.data.rotary));
-    memcpy(macro_buffer, flash.data.macro_buffer, sizeof(flash.data.macro_buffer));
-    memcpy(macro_len, flash.data.macro_len, sizeof(flash.data.macro_len));
-    memcpy(palette, flash.data.palette, sizeof(flash.data.palette));
-    memcpy(lightmap.data, flash.data.lightmap.data, sizeof(flash.data.lightmap));
-    layer = flash.data.layer;
-    nkro_active = flash.data.nkro_active;
-    rgbintensity = flash.data.rgbintensity;
-    cm_enable_interrupts();
+    flash_slot = flash_slot_select();
+    if (flash_slot == NULL) {
+        elog_warn("no configuration log");
+        return 0;
+    }
+
+    flash_defaults();
+    flash_end = flash_log_walk(flash_slot, flash_apply, NULL);
+    flash_settings_set();
 
+    elog("configuration %d uses %d of %d bytes", flash_slot->sequence, flash_end * 4,
+         sizeof(flash_slot->log));
     return 1;
 }
 
-static uint32_t
-flash_write_block(void *dest, const void *src, uint32_t len)
+/*
+ * Start saving the configuration; flash_process does the writing. The
+ * end is reported as a line, or as a frame when the save came in a frame.
+ */
+uint32_t
+flash_write_config(bool framed)
 {
-    uint32_t i;
-    uint32_t status;
-    uint32_t d = (uint32_t)dest;
-    uint32_t s = (uint32_t)src;
+    uint16_t words;
 
-    if ((d < (uint32_t)&flash) ||
-        ((d + len) > ((uint32_t)&flash + sizeof(flash)))) {
-        elog("write address address outside of user flash range");
+    if (flash_active) {
+        elog_warn("flash busy saving");
         return 0;
     }
-    for (i = 0; i < len; i += sizeof(uint32_t)) {
-        flash_program_word(d, *((uint32_t *)s));
-        status = flash_get_status_flags();
-        if (status != FLASH_SR_EOP) {
-            elog("error after write %d:%02x", i, status);
+
+    memset(&flash_save, 0, sizeof(flash_save));
+    flash_save.framed = framed;
+    flash_import.slot = NULL;
+    flash_settings_get();
+
+    flash_slot = flash_slot_select();
+    if (flash_slot) {
+        flash_end = flash_log_walk(flash_slot, flash_compare, &flash_save.saved);
+    }
+
+    words = flash_runs_size(flash_save.saved);
+
+    if ((flash_slot == NULL) || (words > (FLASH_LOG_LEN - flash_end))) {
+        /* Start over with the whole configuration in the other slot */
+        memset(flash_save.saved, 0, sizeof(flash_save.saved));
+        if (flash_runs_size(flash_save.saved) > FLASH_LOG_LEN) {
+            elog_error("configuration does not fit");
             return 0;
         }
-
-        d += sizeof(uint32_t);
-        s += sizeof(uint32_t);
+        flash_save.slot = (flash_slot == &flash.slot[0]) ? &flash.slot[1] : &flash.slot[0];
+        flash_save.compact = true;
+        flash_save.state = FLASH_SAVE_ERASE;
+        elog("erasing slot %d", flash_save.slot - flash.slot);
+    } else {
+        flash_save.slot = flash_slot;
+        flash_save.end = flash_end;
+        flash_save.state = FLASH_SAVE_HEADER;
+        if (words) {
+            elog("writing configuration");
+        } else {
+            elog("configuration unchanged");
+        }
     }
 
+    flash_clear_status_flags();
+    flash_unlock();
+    flash_active = true;
     return 1;
 }
 
-uint32_t
-flash_write_config(void)
+static void
+flash_import_done(bool ok, bool framed)
 {
-    uint32_t data;
+    uint8_t status = ok;
+
+    flash_lock();
+    flash_active = false;
+    flash_import.slot = NULL;
+
+    if (framed) {
+        frame_send(CMD_FLASH_IMAGE, &status, sizeof(status));
+    } else {
+        printfnl(ok ? "imported" : "import failed");
+    }
+}
+
+/*
+ * The slot for an import is erased; the image can come in now
+ */
+static void
+flash_import_ready(void)
+{
+    uint8_t status = FLASH_IMAGE_READY;
+
+    flash_lock();
+    flash_active = false;
+
+    if (flash_save.framed) {
+        frame_send(CMD_FLASH_IMAGE, &status, sizeof(status));
+    } else {
+        printfnl("import ready");
+    }
+}
+
+static void
+flash_save_done(bool ok)
+{
+    uint8_t status = ok;
+
+    flash_lock();
+    flash_active = false;
+
+    if (flash_save.import) {
+        /* An import that gets here failed; it ends in FLASH_SAVE_LOAD */
+        flash_import_done(ok, flash_save.framed);
+        return;
+    }
+
+    if (flash_save.clear) {
+        if (flash_save.framed) {
+            frame_send(CMD_FLASH_CLEAR, &status, sizeof(status));
+        } else {
+            printfnl(ok ? "cleared" : "clear failed");
+        }
+        return;
+    }
+
+    if (! flash_save.compact) {
+        /* Words written to the active log stay used, even if cut short */
+        flash_end = flash_save.end;
+    } else if (ok) {
+        flash_slot = flash_save.slot;
+        flash_end = flash_save.end;
+    }
+
+    if (ok) {
+        flash_log_walk(flash_slot, flash_attach, NULL);
+        elog("configuration %d uses %d of %d bytes", flash_slot->sequence, flash_end * 4,
+             sizeof(flash_slot->log));
+    }
+
+    if (flash_save.framed) {
+        frame_send(CMD_FLASH_SAVE, &status, sizeof(status));
+    } else {
+        printfnl(ok ? "saved" : "save failed");
+    }
+}
+
+/*
+ * Build the record for a run: returns its header word, and leaves the
+ * payload in flash_save.pack
+ */
+static uint32_t
+flash_record_build(const struct flash_run *run)
+{
+    const struct flash_table *table = &flash_tables[run->table];
+    flashrecord_t record;
+    uint32_t word;
+
+    record.type = table->type;
+    record.index = run->index;
+    record.len = run->size;
+    if (run->size < run->len) {
+        record.type |= FLASH_PACKED;
+    }
+
+    if (table->type == FLASH_MACRO) {
+        flash_pack_macro(run->index, flash_save.pack, record.type & FLASH_PACKED);
+    } else if (record.type & FLASH_PACKED) {
+        flash_pack(table, run->index, run->len, flash_save.pack);
+    } else {
+        memcpy(flash_save.pack, flash_entry(table, run->index, run->len), run->len);
+    }
+
+    memcpy(&word, &record, sizeof(word));
+    return word;
+}
+
+/*
+ * The payload word at byte offset done of a record of size bytes, padded
+ * with zeroes
+ */
+static uint32_t
+flash_payload_word(uint16_t size, uint16_t done)
+{
+    uint32_t word = 0;
+
+    memcpy(&word, flash_save.pack + done,
+           ((size - done) < sizeof(word)) ? (size - done) : sizeof(word));
+    return word;
+}
+
+/*
+ * The crc unit's crc32 in software, for the image crc that runs while the
+ * unit is busy with record crcs
+ */
+static uint32_t
+flash_image_crc(uint32_t crc, uint32_t word)
+{
+    uint8_t i;
+
+    crc ^= word;
+    for (i = 0; i < 32; i++) {
+        crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04c11db7) : (crc << 1);
+    }
+    return crc;
+}
+
+static void
+flash_count(const flashrecord_t *record, const uint8_t *payload, void *arg)
+{
+    (void)record;
+    (void)payload;
+
+    (*(uint16_t *)arg)++;
+}
+
+static bool
+flash_save_step(void)
+{
+    uint16_t records;
+    uint32_t word;
+
+    switch (flash_save.state) {
+        case FLASH_SAVE_ERASE:
+            flash_erase_page((uint32_t)flash_save.slot + (flash_save.page * FLASH_PAGE_SIZE));
+            if (! flash_check("page erase", flash_save.page)) {
+                return false;
+            }
+            if (flash_save.clear) {
+                if (++flash_save.page == FLASH_PAGE_NUM) {
+                    flash_save_done(true);
+                }
+                break;
+            }
+            if (++flash_save.page == FLASH_SLOT_PAGES) {
+                if (flash_save.import) {
+                    flash_import_ready();
+                    break;
+                }
+                flash_save.state = FLASH_SAVE_HEADER;
+            }
+            break;
+
+        case FLASH_SAVE_HEADER:
+            if (! flash_run_next(flash_save.saved, &flash_save.run)) {
+                if (flash_save.compact) {
+                    flash_save.state = FLASH_SAVE_VERIFY;
+                } else {
+                    flash_save_done(true);
+                }
+                break;
+            }
+            word = flash_record_build(&flash_save.run);
+            flash_save.start = flash_save.end;
+            flash_save.done = 0;
+            if (! flash_write_word(&flash_save.slot->log[flash_save.end++], word)) {
+                return false;
+            }
+            flash_save.state = flash_save.run.size ? FLASH_SAVE_PAYLOAD : FLASH_SAVE_CRC;
+            break;
+
+        case FLASH_SAVE_PAYLOAD:
+            word = flash_payload_word(flash_save.run.size, flash_save.done);
+            if (! flash_write_word(&flash_save.slot->log[flash_save.end++], word)) {
+                return false;
+            }
+            flash_save.done += sizeof(word);
+            if (flash_save.done >= flash_save.run.size) {
+                flash_save.state = FLASH_SAVE_CRC;
+            }
+            break;
+
+        case FLASH_SAVE_CRC:
+            word = flash_record_crc(&flash_save.slot->log[flash_save.start],
+                                    flash_save.end - flash_save.start);
+            if (! flash_write_word(&flash_save.slot->log[flash_save.end++], word)) {
+                return false;
+            }
+            flash_save.records++;
+            flash_save.run.index += flash_save.run.count;
+            flash_save.state = FLASH_SAVE_HEADER;
+            break;
+
+        case FLASH_SAVE_VERIFY:
+            records = 0;
+            if ((flash_log_walk(flash_save.slot, flash_count, &records) != flash_save.end) ||
+                (! flash_save.import && (records != flash_save.records))) {
+                elog_error("slot %d does not read back", flash_save.slot - flash.slot);
+                return false;
+            }
+            flash_save.state = FLASH_SAVE_SEQUENCE;
+            break;
+
+        case FLASH_SAVE_SEQUENCE:
+            if (! flash_write_word(&flash_save.slot->sequence,
+                                   flash_slot ? flash_slot->sequence + 1 : 1)) {
+                return false;
+            }
+            flash_save.state = FLASH_SAVE_MAGIC;
+            break;
+
+        case FLASH_SAVE_MAGIC:
+            if (! flash_write_word(&flash_save.slot->magic, FLASH_LOG_MAGIC)) {
+                return false;
+            }
+            if (flash_save.import) {
+                flash_save.state = FLASH_SAVE_LOAD;
+                break;
+            }
+            flash_save_done(true);
+            break;
+
+        case FLASH_SAVE_IMAGE:
+            if (flash_import.taken == flash_import.queued) {
+                flash_import.taken = flash_import.queued = 0;
+                if (flash_import.pos == (flash_import.words + 3)) {
+                    flash_save.state = FLASH_SAVE_IMAGE_CRC;
+                } else {
+                    /* Wait for the next piece */
+                    flash_lock();
+                    flash_active = false;
+                }
+                break;
+            }
+            word = flash_import.queue[flash_import.taken++];
+            if (! flash_write_word(&flash_save.slot->log[flash_save.end], word)) {
+                return false;
+            }
+            /* The crc must match what the flash holds now */
+            flash_import.crc = flash_image_crc(flash_import.crc,
+                                               flash_save.slot->log[flash_save.end++]);
+            break;
+
+        case FLASH_SAVE_IMAGE_CRC:
+            if (flash_import.crc != flash_import.image_crc) {
+                elog_error("image has a bad crc");
+                return false;
+            }
+            flash_save.state = FLASH_SAVE_VERIFY;
+            break;
+
+        case FLASH_SAVE_LOAD:
+            flash_lock();
+            flash_active = false;
+            flash_macros_detach();
+            flash_import_done(flash_read_config(), flash_save.framed);
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * Called from the main loop while flash_active. An erase holds the cpu
+ * for the page erase time, as every fetch from flash waits for it; it is
+ * a step of its own, and only needed when the active log is full, for an
+ * import, or to clear the flash.
+ */
+void
+flash_process()
+{
+    uint8_t words;
+    bool erase;
+
+    for (words = 0; flash_active && (words < FLASH_STEP_WORDS); words++) {
+        erase = (flash_save.state == FLASH_SAVE_ERASE);
+        if (! flash_save_step()) {
+            flash_save_done(false);
+        } else if (erase) {
+            break;
+        }
+    }
+}
+
+/*
+ * An export builds the records a save would write to an empty slot, one
+ * record at a time, and sends their words as they are asked for.
+ */
+#define FLASH_EXPORT_FRAME    (FRAME_SEND_MAX / sizeof(uint32_t))
+#define FLASH_EXPORT_LINE     8
+
+enum {
+    FLASH_EXPORT_MAGIC,
+    FLASH_EXPORT_SIZE,
+    FLASH_EXPORT_RECORD,
+    FLASH_EXPORT_CRC,
+    FLASH_EXPORT_END,
+};
+
+static struct {
+    uint8_t state;
+    uint16_t pos;
+    uint16_t words;
+    uint32_t header;
+    uint32_t record_crc;
     uint32_t crc;
+    bool framed;
+} flash_export_state;
 
-    if (! flash_erase()) {
+uint32_t
+flash_export_start(bool framed)
+{
+    if (flash_active) {
+        elog_warn("flash busy saving");
         return 0;
     }
 
-    elog("writing configuration");
+    memset(&flash_save, 0, sizeof(flash_save));
+    memset(&flash_export_state, 0, sizeof(flash_export_state));
+    flash_import.slot = NULL;
+    flash_export_state.crc = FLASH_ERASED;
+    flash_export_state.framed = framed;
+    flash_settings_get();
+    return 1;
+}
 
-    if (!flash_write_block(&flash.data.keymap,
-                            keymap,
-                            sizeof(flash.data.keymap))) {
-        return 0;
+static bool
+flash_export_word(uint32_t *word)
+{
+    uint16_t i;
+
+    switch (flash_export_state.state) {
+        case FLASH_EXPORT_MAGIC:
+            *word = FLASH_IMAGE_MAGIC;
+            flash_export_state.state = FLASH_EXPORT_SIZE;
+            break;
+
+        case FLASH_EXPORT_SIZE:
+            *word = flash_runs_size(flash_save.saved);
+            flash_export_state.state = FLASH_EXPORT_RECORD;
+            break;
+
+        case FLASH_EXPORT_RECORD:
+            if (flash_export_state.pos == 0) {
+                if (! flash_run_next(flash_save.saved, &flash_save.run)) {
+                    flash_export_state.state = FLASH_EXPORT_CRC;
+                    return flash_export_word(word);
+                }
+                flash_export_state.header = flash_record_build(&flash_save.run);
+                flash_export_state.words = FLASH_WORDS(flash_save.run.size);
+                crc_reset();
+                flash_export_state.record_crc = crc_calculate(flash_export_state.header);
+                for (i = 0; i < flash_export_state.words; i++) {
+                    flash_export_state.record_crc =
+                        crc_calculate(flash_payload_word(flash_save.run.size, i * 4));
+                }
+            }
+
+            if (flash_export_state.pos == 0) {
+                *word = flash_export_state.header;
+            } else if (flash_export_state.pos <= flash_export_state.words) {
+                *word = flash_payload_word(flash_save.run.size, (flash_export_state.pos - 1) * 4);
+            } else {
+                *word = flash_export_state.record_crc;
+            }
+
+            if (++flash_export_state.pos > (flash_export_state.words + 1)) {
+                flash_export_state.pos = 0;
+                flash_save.run.index += flash_save.run.count;
+            }
+            break;
+
+        case FLASH_EXPORT_CRC:
+            *word = flash_export_state.crc;
+            flash_export_state.state = FLASH_EXPORT_END;
+            return true;
+
+        default:
+            return false;
     }
-    if (!flash_write_block(&flash.data.rotary,
-                            rotary,
-                            sizeof(flash.data.rotary))) {
-        return 0;
+
+    flash_export_state.crc = flash_image_crc(flash_export_state.crc, *word);
+    return true;
+}
+
+/*
+ * Dump generator for the image: a frame of FLASH_EXPORT_FRAME words, or a
+ * line of FLASH_EXPORT_LINE words as hex bytes that Fp takes back
+ */
+bool
+flash_export(uint16_t index)
+{
+    uint8_t buf[FLASH_EXPORT_FRAME * sizeof(uint32_t)];
+    char line[(FLASH_EXPORT_LINE * sizeof(uint32_t) * 2) + 1];
+    uint8_t i, words;
+    uint32_t word;
+
+    (void)index;
+
+    words = flash_export_state.framed ? FLASH_EXPORT_FRAME : FLASH_EXPORT_LINE;
+    for (i = 0; (i < words) && flash_export_word(&word); i++) {
+        memcpy(&buf[i * sizeof(word)], &word, sizeof(word));
     }
-    if (!flash_write_block(&flash.data.macro_buffer,
-                            macro_buffer,
-                            sizeof(flash.data.macro_buffer))) {
-        return 0;
+
+    if (i == 0) {
+        return false;
     }
-    if (!flash_write_block(&flash.data.macro_len,
-                           macro_len,
-                           sizeof(flash.data.macro_len))) {
-        return 0;
+
+    if (flash_export_state.framed) {
+        frame_send(CMD_FLASH_IMAGE, buf, i * sizeof(word));
+    } else {
+        for (words = 0; words < (i * sizeof(word)); words++) {
+            line[words * 2] = "0123456789abcdef"[buf[words] >> 4];
+            line[(words * 2) + 1] = "0123456789abcdef"[buf[words] & 0x0f];
+        }
+        line[words * 2] = '\0';
+        printfnl("%s", line);
     }
-    if (!flash_write_block(&flash.data.palette,
-                           palette,
-                           sizeof(flash.data.palette))) {
-        return 0;
+
+    return true;
+}
+
+/*
+ * Take the next word of an image: check the magic and size, and queue the
+ * words of the log for flash_process to program. Returns false when the
+ * import failed.
+ */
+static bool
+flash_import_word(uint32_t word)
+{
+    uint16_t pos = flash_import.pos++;
+
+    if (pos == 0) {
+        if (word != FLASH_IMAGE_MAGIC) {
+            elog_error("no configuration image");
+            return false;
+        }
+    } else if (pos == 1) {
+        if (word > FLASH_LOG_LEN) {
+            elog_error("image does not fit");
+            return false;
+        }
+        flash_import.words = word;
+    } else if (pos < (flash_import.words + 2)) {
+        if (flash_import.queued == FLASH_IMPORT_WORDS) {
+            elog_error("image piece too long");
+            return false;
+        }
+        flash_import.queue[flash_import.queued++] = word;
+        return true;
+    } else if (pos == (flash_import.words + 2)) {
+        flash_import.image_crc = word;
+        return true;
+    } else {
+        elog_error("image runs past its crc");
+        return false;
     }
-    if (!flash_write_block(&flash.data.lightmap.data,
-                           lightmap.data,
-                           sizeof(flash.data.lightmap))) {
-        return 0;
+
+    flash_import.crc = flash_image_crc(flash_import.crc, word);
+    return true;
+}
+
+/*
+ * Erase the slot that is not active for an import. The erase runs from
+ * flash_process; its end is reported as "import ready", or as a frame
+ * holding FLASH_IMAGE_READY when the import came in frames.
+ */
+static uint32_t
+flash_import_start(bool framed)
+{
+    memset(&flash_import, 0, sizeof(flash_import));
+    flash_import.crc = FLASH_ERASED;
+    flash_slot = flash_slot_select();
+    flash_import.slot = (flash_slot == &flash.slot[0]) ? &flash.slot[1] : &flash.slot[0];
+
+    memset(&flash_save, 0, sizeof(flash_save));
+    flash_save.slot = flash_import.slot;
+    flash_save.state = FLASH_SAVE_ERASE;
+    flash_save.import = true;
+    flash_save.framed = framed;
+
+    elog("erasing slot %d for import", flash_import.slot - flash.slot);
+    flash_clear_status_flags();
+    flash_unlock();
+    flash_active = true;
+    return 1;
+}
+
+/*
+ * Import len bytes of an image at offset. An empty piece at offset 0
+ * starts an import; once the slot is ready, the image has to arrive in
+ * order from offset 0. Each piece is programmed from flash_process, and
+ * serial input waits meanwhile. When its crc is in, the image is checked
+ * and loaded, and the end is reported as a line, or as a frame when it
+ * came in frames.
+ */
+uint32_t
+flash_import_put(uint16_t offset, const uint8_t *data, uint16_t len, bool framed)
+{
+    if ((offset == 0) && (len == 0)) {
+        if (flash_active) {
+            elog_warn("flash busy saving");
+            return 0;
+        }
+        return flash_import_start(framed);
     }
-    data = (uint32_t)layer;
-    if (!flash_write_block(&flash.data.layer,
-                           &data,
-                           sizeof(data))) {
+
+    if (flash_active && (flash_save.state != FLASH_SAVE_IMAGE)) {
+        elog_warn("flash busy saving");
         return 0;
     }
-    data = (uint32_t)nkro_active;
-    if (!flash_write_block(&flash.data.nkro_active,
-                           &data,
-                           sizeof(data))) {
+
+    if ((flash_import.slot == NULL) || (offset != flash_import.offset)) {
+        elog_error("image out of order at %d", offset);
+        flash_import_done(false, framed);
         return 0;
     }
-    data = (uint32_t)rgbintensity;
-    if (!flash_write_block(&flash.data.rgbintensity,
-                           &data,
-                           sizeof(data))) {
-        return 0;
+
+    for (; len; len--, data++) {
+        flash_import.word |= (uint32_t)*data << ((flash_import.offset & 0x03) * 8);
+        if ((++flash_import.offset & 0x03) == 0) {
+            if (! flash_import_word(flash_import.word)) {
+                flash_import_done(false, framed);
+                return 0;
+            }
+            flash_import.word = 0;
+        }
     }
-    crc = flash_crc();
-    if (!flash_write_block(&flash.crc.crc, &crc, sizeof(crc))) {
-        return 0;
+
+    if (! flash_active) {
+        flash_save.state = FLASH_SAVE_IMAGE;
+        flash_clear_status_flags();
+        flash_unlock();
+        flash_active = true;
     }
-    flash_lock();
     return 1;
 }
+
+/*
+ * Whether an import holds the flash; serial input waits until it is done
+ */
+bool
+flash_import_busy()
+{
+    return flash_active && flash_save.import;
+}
@@ -28,6 +28,7 @@
 #ifndef _FLASH_H
 #define _FLASH_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /*
@@ -36,10 +37,29 @@
  */
 #define FLASH_ALIGNED_SIZE(x) ((x + 0b11) & ~ 0b11)
 
+/*
+ * Configuration image, as exported by Fg and imported by Fp; words are
+ * little endian:
+ *
+ * | bytes | description                                          |
+ * |-------+------------------------------------------------------|
+ * |     4 | magic "CFG1"                                         |
+ * |     4 | number n of record words                             |
+ * | 4 * n | the records of the whole configuration, as in flash  |
+ * |     4 | crc32 of the words before it, as the stm32 crc unit  |
+ */
+
 void crc_init(void);
 
-uint32_t flash_clear_config(void);
+extern bool flash_active;
+
+uint32_t flash_clear_config(bool framed);
 uint32_t flash_read_config(void);
-uint32_t flash_write_config(void);
+uint32_t flash_write_config(bool framed);
+void flash_process(void);
+uint32_t flash_export_start(bool framed);
+bool flash_export(uint16_t index);
+uint32_t flash_import_put(uint16_t offset, const uint8_t *data, uint16_t len, bool framed);
+bool flash_import_busy(void);
 
 #endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * frame
+ *
+ * Decode binary command frames one byte at a time, as they come in. The
+ * payload is gathered in its own buffer, so it can be larger than the
+ * serial input ring, and is only executed once the crc checks out.
+ */
+
+#include <string.h>
+
+#include "clock.h"
+#include "command.h"
+#include "config.h"
+#include "elog.h"
+#include "frame.h"
+#include "ring.h"
+#include "serial.h"
+
+#define ELOG_MODULE ELOG_FRAME
+
+enum {
+    FRAME_IDLE = 0,
+    FRAME_LEN_LO,
+    FRAME_LEN_HI,
+    FRAME_OPCODE,
+    FRAME_PAYLOAD,
+    FRAME_CRC_LO,
+    FRAME_CRC_HI,
+    FRAME_DISCARD,
+};
+
+static uint8_t frame_state = FRAME_IDLE;
+static uint8_t frame_opcode;
+static uint16_t frame_len;
+static uint16_t frame_todo;
+static uint16_t frame_crc;
+static uint16_t frame_crc_rx;
+static uint32_t frame_timer;
+
+static struct ring payload_ring;
+static uint8_t payload_buffer[FRAME_PAYLOAD_MAX + 1];
+
+static uint16_t
+frame_crc_update(uint16_t crc, uint8_t c)
+{
+    uint8_t i;
+
+    crc ^= (uint16_t)c << 8;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+static void
+frame_ack(void)
+{
+    uint8_t reply[2] = { FRAME_ACK, frame_opcode };
+
+    serial_write(reply, sizeof(reply));
+}
+
+static void
+frame_nak(uint8_t reason)
+{
+    uint8_t reply[3] = { FRAME_NAK, frame_opcode, reason };
+
+    elog_warn("frame %02x nak %d", frame_opcode, reason);
+    serial_write(reply, sizeof(reply));
+}
+
+bool
+frame_active()
+{
+    return (frame_state != FRAME_IDLE);
+}
+
+void
+frame_start()
+{
+    ring_init(&payload_ring, payload_buffer, sizeof(payload_buffer));
+    frame_opcode = 0;
+    frame_crc = 0xffff;
+    frame_state = FRAME_LEN_LO;
+    frame_timer = timer_set(MS_FRAME);
+}
+
+void
+frame_decode(uint8_t c)
+{
+    frame_timer = timer_set(MS_FRAME);
+
+    if (frame_state < FRAME_CRC_LO) {
+        frame_crc = frame_crc_update(frame_crc, c);
+    }
+
+    switch (frame_state) {
+        case FRAME_LEN_LO:
+            frame_len = c;
+            frame_state = FRAME_LEN_HI;
+            break;
+
+        case FRAME_LEN_HI:
+            frame_len |= (uint16_t)c << 8;
+            frame_todo = frame_len;
+            frame_state = FRAME_OPCODE;
+            break;
+
+        case FRAME_OPCODE:
+            frame_opcode = c;
+            if (frame_len > FRAME_PAYLOAD_MAX) {
+                /* Skip payload and crc, so they are not taken as text */
+                frame_todo = frame_len + 2;
+                frame_state = FRAME_DISCARD;
+            } else {
+                frame_state = frame_todo ? FRAME_PAYLOAD : FRAME_CRC_LO;
+            }
+            break;
+
+        case FRAME_PAYLOAD:
+            ring_write_ch(&payload_ring, c);
+            if (--frame_todo == 0) {
+                frame_state = FRAME_CRC_LO;
+            }
+            break;
+
+        case FRAME_CRC_LO:
+            frame_crc_rx = c;
+            frame_state = FRAME_CRC_HI;
+            break;
+
+        case FRAME_CRC_HI:
+            frame_crc_rx |= (uint16_t)c << 8;
+            frame_state = FRAME_IDLE;
+            if (frame_crc_rx != frame_crc) {
+                frame_nak(FRAME_NAK_CRC);
+            } else if (command_frame(frame_opcode, &payload_ring)) {
+                frame_ack();
+            } else {
+                frame_nak(FRAME_NAK_ARGS);
+            }
+            break;
+
+        case FRAME_DISCARD:
+            if (--frame_todo == 0) {
+                frame_state = FRAME_IDLE;
+                frame_nak(FRAME_NAK_LENGTH);
+            }
+            break;
+    }
+}
+
+/*
+ * Give up on a frame that stopped halfway, so text commands work again
+ */
+void
+frame_timeout()
+{
+    if (frame_active() &&
+        timer_passed(frame_timer)) {
+        frame_state = FRAME_IDLE;
+        frame_nak(FRAME_NAK_TIMEOUT);
+    }
+}
+
+/*
+ * Returns whether the frame went into the output
+ */
+bool
+frame_send(uint8_t opcode, uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[FRAME_SEND_MAX + FRAME_OVERHEAD];
+    uint16_t crc = 0xffff;
+    uint16_t i;
+
+    if (len > FRAME_SEND_MAX) {
+        return false;
+    }
+
+    frame[0] = FRAME_STX;
+    frame[1] = len;
+    frame[2] = len >> 8;
+    frame[3] = opcode;
+    memcpy(&frame[4], payload, len);
+
+    for (i = 1; i < len + 4; i++) {
+        crc = frame_crc_update(crc, frame[i]);
+    }
+    frame[len + 4] = crc;
+    frame[len + 5] = crc >> 8;
+
+    return serial_write(frame, len + FRAME_OVERHEAD);
+}
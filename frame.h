@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Binary command frame:
+ *
+ * | bytes | description                                 |
+ * |-------+---------------------------------------------|
+ * |     1 | FRAME_STX                                   |
+ * |     2 | payload length, little endian               |
+ * |     1 | opcode, same letter as the text command     |
+ * |     n | payload, the command arguments as bytes     |
+ * |     2 | crc16 ccitt over length, opcode and payload |
+ *
+ * Every frame is answered with FRAME_ACK <opcode>, or with
+ * FRAME_NAK <opcode> <reason>. The keyboard sends frames of the same
+ * format, up to FRAME_SEND_MAX payload so that they fit one usb packet.
+ */
+#define FRAME_STX                0x02
+#define FRAME_ACK                0x06
+#define FRAME_NAK                0x15
+
+#define FRAME_PAYLOAD_MAX        511
+#define FRAME_SEND_MAX           58
+#define FRAME_OVERHEAD           6
+
+enum {
+    FRAME_NAK_CRC = 1,
+    FRAME_NAK_LENGTH,
+    FRAME_NAK_ARGS,
+    FRAME_NAK_TIMEOUT,
+};
+
+bool frame_active(void);
+void frame_start(void);
+void frame_decode(uint8_t c);
+void frame_timeout(void);
+bool frame_send(uint8_t opcode, uint8_t *payload, uint16_t len);
+
+#endif /* _FRAME_H */
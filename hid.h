@@ -40,4 +40,9 @@
 #define USBHID_REQ_SET_IDLE      0x0a
 #define USBHID_REQ_SET_PROTOCOL  0x0b
 
+/* HID report types, high byte of wValue in GET/SET_REPORT */
+#define USBHID_REPORT_TYPE_INPUT    0x01
+#define USBHID_REPORT_TYPE_OUTPUT   0x02
+#define USBHID_REPORT_TYPE_FEATURE  0x03
+
 #endif /* _HID_H */
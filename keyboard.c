@@ -32,12 +32,16 @@
  * host.
  */
 
+#include <string.h>
+
 #include "usb.h"
 #include "keyboard.h"
 #include "usb_keycode.h"
 #include "led.h"
 #include "elog.h"
 
+#define ELOG_MODULE ELOG_KEYBOARD
+
 static report_keyboard_t keyboard_state;
 static bool keyboard_dirty = false;
 bool keyboard_active = false;
@@ -48,6 +52,15 @@ bool nkro_active = false;
 static bool nkro_dirty = false;
 uint8_t nkro_idle = 0;
 
+/*
+ * nkro_active is the configured mode. A rollover promotes to nkro for as
+ * long as keys are held; nkro_sending is the mode reports go out in.
+ */
+static bool nkro_promoted = false;
+static bool nkro_sending = false;
+
+static void keyboard_boot_update(void);
+
 void
 keyboard_set_protocol(uint8_t protocol)
 {
@@ -83,7 +96,7 @@ keyboard_event(event_t *event, bool pressed)
     uint8_t mod = event->key.mod;
     uint8_t key = event->key.code;
 
-    elog("key %02x %02x %d", mod, key, pressed);
+    elog_debug("key %02x %02x %d", mod, key, pressed);
 
     if (mod) {
         if (pressed) {
@@ -101,6 +114,64 @@ keyboard_event(event_t *event, bool pressed)
         }
     }
 
+    keyboard_flush();
+}
+
+static bool
+keyboard_keys_held(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < sizeof(nkro_state.bits); i++) {
+        if (nkro_state.bits[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Follow a change of the configured mode or the end of a promotion. The
+ * endpoint that is left gets an empty report, so the host does not keep
+ * its keys held down; the other one gets the keys that are down now.
+ */
+static void
+keyboard_mode_update(void)
+{
+    report_nkro_t released;
+    bool nkro;
+
+    if (nkro_promoted && ! keyboard_keys_held()) {
+        nkro_promoted = false;
+    }
+
+    nkro = nkro_active || nkro_promoted;
+    if (nkro == nkro_sending) {
+        return;
+    }
+    nkro_sending = nkro;
+
+    if (nkro) {
+        memset(&keyboard_state, 0, sizeof(keyboard_state));
+        usb_update_keyboard(&keyboard_state);
+        keyboard_dirty = false;
+        nkro_dirty = true;
+    } else {
+        memset(&released, 0, sizeof(released));
+        usb_update_nkro(&released);
+        nkro_dirty = false;
+        keyboard_boot_update();
+    }
+}
+
+/*
+ * Send the reports that changed since the last flush
+ */
+void
+keyboard_flush()
+{
+    keyboard_mode_update();
+
     if (keyboard_dirty) {
         usb_update_keyboard(&keyboard_state);
         keyboard_dirty = false;
@@ -112,60 +183,132 @@ keyboard_event(event_t *event, bool pressed)
     }
 }
 
+/*
+ * Pick up mode changes made outside of key events: by the host, over
+ * serial or by loading the configuration
+ */
 void
-keyboard_add_key(uint8_t key)
+keyboard_process()
 {
-    uint8_t i;
-    uint8_t k;
-
-    if (nkro_active) {
-        /*
-         * NKRO is coded as n bits where each bit corresponds with an pressed
-         * key. The first bit corresponds with the first real key that can be
-         * pressed, i.e. KEY_A
-         */
-        k = key - KEY_A;
-        if ((k >> 3) < sizeof(nkro_state.bits)) {
-            nkro_state.bits[k >> 3] |= (1 << (k & 0x07));
-            nkro_dirty = true;
-            return;
+    if (usb_ep_keyboard_idle && usb_ep_nkro_idle) {
+        keyboard_flush();
+    }
+}
+
+/*
+ * Switch the configured mode; once the keyboard runs, the reports follow
+ * as soon as the endpoints are idle
+ */
+void
+keyboard_set_nkro(bool enable)
+{
+    nkro_active = enable;
+    if (keyboard_active) {
+        keyboard_process();
+    }
+}
+
+/*
+ * NKRO is coded as n bits where each bit corresponds with an pressed
+ * key. The first bit corresponds with the first usage in the keyboard
+ * page, so every key upto KEY_LCTRL has a bit. The modifier keys
+ * themselves live in the mods byte.
+ *
+ * The bitmap is kept up to date in boot mode as well. It is the record of
+ * what is pressed; the boot report is derived from it. That way keys can
+ * be held beyond the 6 boot slots without losing any of them.
+ */
+static bool
+keyboard_is_modifier(uint8_t key)
+{
+    return ((key >= KEY_LCTRL) && (key <= KEY_RGUI));
+}
+
+static bool
+keyboard_nkro_fits(uint8_t key)
+{
+    return ((key >> 3) < sizeof(nkro_state.bits));
+}
+
+/*
+ * Rebuild the boot report from the pressed key bitmap. When more keys are
+ * held than fit the boot report, either move over to nkro -- if the host
+ * has picked up the nkro interface -- or signal ErrorRollOver in all slots
+ * as the boot protocol prescribes.
+ */
+static void
+keyboard_boot_update(void)
+{
+    report_keyboard_t boot = { .mods = keyboard_state.mods };
+    uint16_t key;
+    uint8_t i = 0;
+
+    for (key = 0; key < (sizeof(nkro_state.bits) << 3); key++) {
+        if (nkro_state.bits[key >> 3] & (1 << (key & 0x07))) {
+            if (i == sizeof(boot.keys)) {
+                break;
+            }
+            boot.keys[i++] = key;
         }
     }
 
-    /* nkro inactive or keycode too large for nkro, on to boot keyboard */
-    for (i = 0; i < sizeof(keyboard_state.keys); i++) {
-        if ((keyboard_state.keys[i] == 0) ||
-            (keyboard_state.keys[i] == key)) {
-            keyboard_state.keys[i] = key;
-            keyboard_dirty = true;
+    if (key < (sizeof(nkro_state.bits) << 3)) {
+        if (usb_ifs_enumerated & (1 << IF_NKRO)) {
+            /* nkro takes over until all keys are released again */
+            elog("rollover, promoting to nkro");
+            nkro_promoted = true;
+            keyboard_mode_update();
             return;
         }
+        memset(boot.keys, EVENT_ERRORROLLOVER, sizeof(boot.keys));
+    }
+
+    if (memcmp(&boot, &keyboard_state, sizeof(boot))) {
+        memcpy(&keyboard_state, &boot, sizeof(boot));
+        keyboard_dirty = true;
+    }
+}
+
+void
+keyboard_add_key(uint8_t key)
+{
+    if (keyboard_is_modifier(key)) {
+        keyboard_add_modifier(1 << (key - KEY_LCTRL));
+        return;
+    }
+
+    if (! keyboard_nkro_fits(key)) {
+        elog_warn("key %02x is reserved", key);
+        return;
+    }
+
+    nkro_state.bits[key >> 3] |= (1 << (key & 0x07));
+
+    if (nkro_sending) {
+        nkro_dirty = true;
+    } else {
+        keyboard_boot_update();
     }
 }
 
 void
 keyboard_del_key(uint8_t key)
 {
-    uint8_t i;
-    uint8_t k;
+    if (keyboard_is_modifier(key)) {
+        keyboard_del_modifier(1 << (key - KEY_LCTRL));
+        return;
+    }
 
-    if (nkro_active) {
-        k = key - KEY_A;
-        if ((k >> 3) < sizeof(nkro_state.bits)) {
-            nkro_state.bits[k >> 3] &= ~(1 << (k & 0x07));
-            nkro_dirty = true;
-            return;
-        }
+    if (! keyboard_nkro_fits(key)) {
+        return;
     }
 
-    /* nkro inactive or keycode too large for nkro, on to boot keyboard */
+    nkro_state.bits[key >> 3] &= ~(1 << (key & 0x07));
 
-    for (i = 0; i < sizeof(keyboard_state.keys); i++) {
-        if (keyboard_state.keys[i] == key) {
-            keyboard_state.keys[i] = 0;
-            keyboard_dirty = true;
-            return;
-        }
+    if (nkro_sending) {
+        nkro_dirty = true;
+    } else {
+        keyboard_boot_update();
     }
 }
 
@@ -175,7 +318,7 @@ keyboard_add_modifier(uint8_t modifier)
     keyboard_state.mods |= modifier;
     nkro_state.mods |= modifier;
 
-    if (nkro_active) {
+    if (nkro_sending) {
         nkro_dirty = true;
     } else {
         keyboard_dirty = true;
@@ -188,7 +331,7 @@ keyboard_del_modifier(uint8_t modifier)
     keyboard_state.mods &= ~modifier;
     nkro_state.mods &= ~modifier;
 
-    if (nkro_active) {
+    if (nkro_sending) {
         nkro_dirty = true;
     } else {
         keyboard_dirty = true;
@@ -38,6 +38,9 @@ void keyboard_set_protocol(uint8_t protocol);
 uint8_t *keyboard_get_protocol(void);
 report_keyboard_t *keyboard_report(void);
 void keyboard_event(event_t *event, bool pressed);
+void keyboard_flush(void);
+void keyboard_process(void);
+void keyboard_set_nkro(bool enable);
 void keyboard_add_key(uint8_t key);
 void keyboard_del_key(uint8_t key);
 void keyboard_set_leds(uint8_t leds);
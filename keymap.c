@@ -44,9 +44,13 @@
 #include "layer.h"
 #include "macro.h"
 #include "mouse.h"
+#include "mousekey.h"
 #include "serial.h"
+#include "stage.h"
 #include "usb_keycode.h"
 
+#define ELOG_MODULE ELOG_KEYMAP
+
 event_t keymap[LAYERS_NUM][ROWS_NUM][COLS_NUM] =
 {
     {
@@ -72,27 +76,39 @@ event_t keymap[LAYERS_NUM][ROWS_NUM][COLS_NUM] =
     },
 };
 
-void
-keymap_dump()
+/*
+ * Dump generator; per layer a header line followed by a line per row
+ */
+bool
+keymap_dump(uint16_t index)
 {
-    uint8_t l, r, c;
+    uint8_t l = index / (ROWS_NUM + 1);
+    uint8_t r = index % (ROWS_NUM + 1);
+    uint8_t c;
     event_t *e;
 
-    for (l = 0; l < LAYERS_NUM; l++) {
+    if (l >= LAYERS_NUM) {
+        return false;
+    }
+
+    if (r == 0) {
         printfnl("layer %02x", l);
-        for (r = 0; r < ROWS_NUM; r++) {
-            printf("row %02x: ", r);
-            for (c = 0; c < COLS_NUM; c++) {
-                e = keymap_get(l, r, c);
-                printf("%01x,%02x,%02x,%02x ",
-                       e->type,
-                       e->args.num1,
-                       e->args.num2,
-                       e->args.num3);
-            }
-            printf("\n\r");
-        }
+        return true;
+    }
+
+    r--;
+    printf("row %02x: ", r);
+    for (c = 0; c < COLS_NUM; c++) {
+        e = keymap_get(l, r, c);
+        printf("%01x,%02x,%02x,%02x ",
+               e->type,
+               e->args.num1,
+               e->args.num2,
+               e->args.num3);
     }
+    printfnl("");
+
+    return true;
 }
 
 event_t *
@@ -101,7 +117,7 @@ keymap_get(uint8_t l, uint8_t r, uint8_t c)
     if ((l > LAYERS_NUM) ||
         (r > ROWS_NUM) ||
         (c > COLS_NUM)) {
-        elog("keymap position out of bounds");
+        elog_error("keymap position out of bounds");
         return 0;
     }
 
@@ -114,11 +130,11 @@ keymap_set(uint8_t l, uint8_t r, uint8_t c, event_t *event)
     if ((l >= LAYERS_NUM) ||
         (r >= ROWS_NUM) ||
         (c >= COLS_NUM)) {
-        elog("keymap position out of bounds");
+        elog_error("keymap position out of bounds");
         return;
     }
 
-    memcpy(&keymap[l][r][c], event, sizeof(event_t));
+    memcpy(stage_keymap(l, r, c), event, sizeof(event_t));
 }
 
 void
@@ -132,7 +148,7 @@ keymap_event(uint16_t row, uint16_t col, bool pressed)
             break;
 
         case KMT_MOUSE:
-            mouse_event(event, pressed);
+            mousekey_event(event, pressed);
             break;
 
         case KMT_AUTOMOUSE:
@@ -143,6 +159,10 @@ keymap_event(uint16_t row, uint16_t col, bool pressed)
             wheel_event(event, pressed);
             break;
 
+        case KMT_POINTER:
+            automouse_pointer_event(event, pressed);
+            break;
+
         case KMT_CONSUMER:
             extrakey_consumer_event(event, pressed);
             break;
@@ -175,7 +195,7 @@ send_event_if_idle(event_t *event, uint8_t press)
 
         case KMT_MOUSE:
             if (usb_ep_mouse_idle) {
-                mouse_event(event, press);
+                mousekey_event(event, press);
             } else {
                 return 0;
             }
@@ -197,6 +217,14 @@ send_event_if_idle(event_t *event, uint8_t press)
             }
             break;
 
+        case KMT_POINTER:
+            if (usb_ep_extrakey_idle) {
+                automouse_pointer_event(event, press);
+            } else {
+                return 0;
+            }
+            break;
+
         case KMT_CONSUMER:
             if (usb_ep_extrakey_idle) {
                 extrakey_consumer_event(event, press);
@@ -207,7 +235,7 @@ send_event_if_idle(event_t *event, uint8_t press)
 
         case KMT_SYSTEM:
             if (usb_ep_extrakey_idle) {
-                extrakey_system_event(event, 1);
+                extrakey_system_event(event, press);
             } else {
                 return 0;
             }
@@ -73,6 +73,11 @@ typedef struct {
             int8_t h;
             int8_t v;
         } __attribute__ ((packed)) wheel;
+        struct {
+            uint8_t button;
+            uint8_t x;
+            uint8_t y;
+        } __attribute__ ((packed)) pointer;
         struct {
             uint8_t empty3;
             uint8_t empty4;
@@ -103,7 +108,8 @@ enum {
     KMT_MACRO,
     KMT_MOUSE,
     KMT_SYSTEM,
-    KMT_WHEEL
+    KMT_WHEEL,
+    KMT_POINTER
 };
 
 #define _AM(Button,Times,Wiggle)  {.type = KMT_AUTOMOUSE, .automouse = {.button = Button, .times = Times, .wiggle = Wiggle}}
@@ -117,12 +123,16 @@ enum {
 #define _KMB(ModBits, Key)        {.type = KMT_KEY, .key = {.mod = ModBits, .code = KEY_##Key}}
 #define _L(Action, Layer)         {.type = KMT_LAYER, .layer = {.action = LAYER_##Action, .number = Layer}}
 #define _M(X,Y)                   {.type = KMT_MOUSE, .mouse = {.button = 0, .x = X, .y = Y}}
+/* Example accelerated move left: _MK(-1, 0, MOUSEKEY_CURVE_DEFAULT) */
+#define _MK(X,Y,Curve)            {.type = KMT_MOUSE, .mouse = {.button = MOUSEKEY_CURVE(Curve), .x = X, .y = Y}}
 #define _MA(Number)               {.type = KMT_MACRO, .macro = {.number = Number}}
+/* Example click center of screen: _P(MOUSE_BUTTON1, 0x80, 0x80) */
+#define _P(Button,X,Y)            {.type = KMT_POINTER, .pointer = {.button = Button, .x = X, .y = Y}}
 #define _S(Mod)                   {.type = KMT_KEY, .key = {.code = 0, .mod = Mod}}
 #define _W(H,V)                   {.type = KMT_WHEEL, .wheel = {.button = 0, .h = H, .v = V}}
 #define _Y(Key)                   {.type = KMT_SYSTEM, .extra = {.code = SYSTEM_##Key}}
 
-void keymap_dump(void);
+bool keymap_dump(uint16_t index);
 event_t *keymap_get(uint8_t layer, uint8_t row, uint8_t column);
 void keymap_set(uint8_t layer, uint8_t row, uint8_t column, event_t *event);
 void keymap_event(uint16_t row, uint16_t col, bool pressed);
@@ -41,6 +41,8 @@
 #include "layer.h"
 #include "light.h"
 
+#define ELOG_MODULE ELOG_LAYER
+
 uint8_t layer = 0;
 
 typedef struct {
@@ -70,6 +72,15 @@ layer_return()
     elog("layer %02x active", layer);
 }
 
+/*
+ * Make a layer active from outside of key events, as when restoring state
+ */
+void
+layer_set(uint8_t next)
+{
+    layer_advance(next);
+}
+
 event_t *
 layer_get_event(uint16_t row, uint16_t col, bool pressed)
 {
@@ -86,7 +97,7 @@ layer_get_event(uint16_t row, uint16_t col, bool pressed)
              * take the layer event structure from the previous layer as our
              * event
              */
-            elog("previous layer keyup detected");
+            elog_debug("previous layer keyup detected");
             result = &keymap[context.previous][row][col];
         } else if (context.nextkey) {
             /*
@@ -108,11 +119,11 @@ layer_event(uint16_t row, uint16_t col, event_t *event, bool pressed)
     uint8_t action = event->layer.action;
     uint8_t number = event->layer.number;
 
-    elog("layer %02x %02x %d", event->layer.action, event->layer.number, pressed);
+    elog_debug("layer %02x %02x %d", event->layer.action, event->layer.number, pressed);
 
     if (pressed) {
         if (context.active) {
-            elog("ignoring layer event: already active");
+            elog_debug("ignoring layer event: already active");
             return;
         } else {
             context.active = true;
@@ -142,7 +153,7 @@ layer_event(uint16_t row, uint16_t col, event_t *event, bool pressed)
         if (context.active &&
             ((context.row != row) ||
              (context.col != col))) {
-            elog("ignoring layer event: already active");
+            elog_debug("ignoring layer event: already active");
             return;
         }
 
@@ -41,6 +41,7 @@ enum {
 
 extern uint8_t layer;
 
+void layer_set(uint8_t next);
 event_t *layer_get_event(uint16_t row, uint16_t col, bool pressed);
 void layer_event(uint16_t row, uint16_t col, event_t *event, bool pressed);
 
@@ -36,6 +36,9 @@
 #include "palette.h"
 #include "rgbease.h"
 #include "rgbmap.h"
+#include "stage.h"
+
+#define ELOG_MODULE ELOG_LIGHT
 
 lightmap_t lightmap =
 {
@@ -64,21 +67,33 @@ lightmap_t lightmap =
 
 lightstate_t light_state;
 
-void
-light_dump()
+/*
+ * Dump generator; per layer a header line followed by a line per row
+ */
+bool
+light_dump(uint16_t index)
 {
-    uint8_t l, r, c;
+    uint8_t l = index / (ROWS_NUM + 1);
+    uint8_t r = index % (ROWS_NUM + 1);
+    uint8_t c;
+
+    if (l >= LAYERS_NUM) {
+        return false;
+    }
 
-    for (l = 0; l < LAYERS_NUM; l++) {
+    if (r == 0) {
         printfnl("layer %02x", l);
-        for (r = 0; r < ROWS_NUM; r++) {
-            printf("row %02x: ", r);
-            for (c = 0; c < COLS_NUM; c++) {
-                printf("%c ", lightmap.data[l][r][c]);
-            }
-            printf("\n\r");
-        }
+        return true;
+    }
+
+    r--;
+    printf("row %02x: ", r);
+    for (c = 0; c < COLS_NUM; c++) {
+        printf("%c ", lightmap.data[l][r][c]);
     }
+    printfnl("");
+
+    return true;
 }
 
 void
@@ -93,7 +108,7 @@ light_set(uint8_t l, uint8_t r, uint8_t c, uint8_t v)
     if ((l >= LAYERS_NUM) ||
         (r >= ROWS_NUM) ||
         (c >= COLS_NUM)) {
-        elog("light position out of bounds");
+        elog_error("light position out of bounds");
         return;
     }
 
@@ -103,25 +118,27 @@ light_set(uint8_t l, uint8_t r, uint8_t c, uint8_t v)
         (v == LIGHT_MACRO) ||
         (v == LIGHT_MUTE) ||
         (v == LIGHT_VOLUME)) {
-        lightmap.data[l][r][c] = v;
+        *stage_lightmap(l, r, c) = v;
     } else {
-        elog("light type unknown");
+        elog_error("light type unknown");
     }
 }
 
 void
 light_set_desktop(uint8_t ascreen, uint8_t adisplay)
 {
-    uint8_t s = ascreen % SCREENS_NUM;
+    uint8_t s;
 
+    /* Screens count from 1; 0 sets all of them */
     if (ascreen == 0) {
         for (s = 0; s < SCREENS_NUM; s++) {
             light_state.desktop[s] = adisplay;
         }
     } else {
-        light_state.desktop[s - 1] = adisplay;
-        if (s > light_state.max_screen) {
-            light_state.max_screen = s;
+        s = (ascreen - 1) % SCREENS_NUM;
+        light_state.desktop[s] = adisplay;
+        if (s >= light_state.max_screen) {
+            light_state.max_screen = s + 1;
         }
     }
     light_apply_state(LIGHT_DESKTOP);
@@ -204,7 +221,9 @@ light_apply_state(uint8_t only_type)
             case LIGHT_DESKTOP:
                 color = palette_get(COLOR_DESKTOP + light_state.desktop[screen]);
                 rgbease_set(id, color, F_COLOR_HOLD, 0, 0);
-                screen = (screen + 1) % light_state.max_screen;
+                if (light_state.max_screen) {
+                    screen = (screen + 1) % light_state.max_screen;
+                }
                 break;
 
             case LIGHT_LAYER:
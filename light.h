@@ -28,6 +28,7 @@
 #ifndef _LIGHT_H
 #define _LIGHT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -133,8 +134,9 @@ typedef struct {
 #define LIGHT_VOLUME_TO_HUE(v) (HUE_SEXTANT + (v / _VOL_RANGE_DIV))
 
 extern lightmap_t lightmap;
+extern lightstate_t light_state;
 
-void light_dump();
+bool light_dump(uint16_t index);
 void light_init(void);
 void light_apply_state(uint8_t only_type);
 void light_set(uint8_t l, uint8_t r, uint8_t c, uint8_t v);
@@ -28,7 +28,9 @@
 /*
  * macro
  *
- * Insert preset macro sequences
+ * Insert preset macro sequences. Saved macros are played from their record
+ * in flash; a macro set over serial lives in a ram overlay slot until the
+ * next save points it at its new record.
  */
 
 #include <string.h>
@@ -42,8 +44,10 @@
 #include "map_ascii.h"
 #include "light.h"
 
-event_t macro_buffer[MACRO_MAXKEYS][MACRO_MAXLEN];
-uint8_t macro_len[MACRO_MAXKEYS];
+#define ELOG_MODULE ELOG_MACRO
+
+macro_t macros[MACRO_MAXKEYS];
+static event_t macro_overlay[MACRO_OVERLAY_NUM][MACRO_MAXLEN];
 
 enum {
     MACRO_INIT,
@@ -61,44 +65,197 @@ macro_init()
 {
     elog("macro: clearing all macros");
 
-    memset(&macro_buffer, 0, sizeof(macro_buffer));
-    memset(&macro_len, 0, sizeof(macro_len));
+    memset(&macros, 0, sizeof(macros));
+}
+
+/*
+ * Take the next event from stored macro data; returns NULL when the data
+ * does not decode
+ */
+static const uint8_t *
+macro_next(const uint8_t *data, bool packed, event_t *event)
+{
+    const event_t *source = (const event_t *)data;
+
+    if (packed) {
+        if (*data == MACRO_ESCAPE) {
+            source = (const event_t *)(data + 1);
+            data += 1 + sizeof(event_t);
+        } else if ((source = map_ascii_to_event(*data++)) == NULL) {
+            return NULL;
+        }
+    } else {
+        data += sizeof(event_t);
+    }
+
+    memcpy(event, source, sizeof(event_t));
+    return data;
+}
+
+/*
+ * Number of events in stored macro data, or -1 if it is no macro
+ */
+static int16_t
+macro_count(const uint8_t *data, uint8_t size, bool packed)
+{
+    const uint8_t *end = data + size;
+    event_t event;
+    int16_t len = 0;
+
+    if (! packed && (size % sizeof(event_t))) {
+        return -1;
+    }
+
+    while (data < end) {
+        if (((data = macro_next(data, packed, &event)) == NULL) ||
+            (data > end) ||
+            (++len > (MACRO_MAXLEN - 1 - 1))) {
+            return -1;
+        }
+    }
+
+    return len;
+}
+
+/*
+ * The overlay slot the macro has, or else a free one
+ */
+static event_t *
+macro_overlay_get(uint8_t key)
+{
+    uint8_t i, slot;
+
+    for (slot = 0; slot < MACRO_OVERLAY_NUM; slot++) {
+        if (macros[key].data == (const uint8_t *)macro_overlay[slot]) {
+            return macro_overlay[slot];
+        }
+    }
+
+    for (slot = 0; slot < MACRO_OVERLAY_NUM; slot++) {
+        for (i = 0; i < MACRO_MAXKEYS; i++) {
+            if (macros[i].data == (const uint8_t *)macro_overlay[slot]) {
+                break;
+            }
+        }
+        if (i == MACRO_MAXKEYS) {
+            return macro_overlay[slot];
+        }
+    }
+
+    return NULL;
 }
 
 void
 macro_set_phrase(uint8_t key, uint8_t *phrase, uint8_t size)
 {
+    event_t *overlay;
     uint8_t i;
-    event_t *event;
 
     if (key > (MACRO_MAXKEYS - 1)) {
-        elog("macro number beyond max");
+        elog_error("macro number beyond max");
         return;
     }
 
     if (size > (MACRO_MAXLEN - 1 - 1)) {
-        elog("macro sequence too long");
+        elog_error("macro sequence too long");
         return;
     }
 
     for (i = 0; i < size; i++) {
-        event = map_ascii_to_event(*phrase);
-        if (event) {
-            memcpy(&macro_buffer[key][i], event, sizeof(event_t));
-        } else {
-            elog("cannot translate %02x to event", *phrase);
+        if (map_ascii_to_event(phrase[i]) == NULL) {
+            elog_error("cannot translate %02x to event", phrase[i]);
             return;
         }
-        phrase++;
     }
-    macro_len[key] = size;
+
+    if ((overlay = macro_overlay_get(key)) == NULL) {
+        elog_error("no room for macro %d, save first", key);
+        return;
+    }
+
+    for (i = 0; i < size; i++) {
+        memcpy(&overlay[i], map_ascii_to_event(phrase[i]), sizeof(event_t));
+    }
+    macros[key].data = (const uint8_t *)overlay;
+    macros[key].size = size * sizeof(event_t);
+    macros[key].len = size;
+    macros[key].packed = false;
     elog("macro %d defined with len %d", key, size);
 }
 
+/*
+ * Play the macro from stored data, e.g. its record in flash. The data
+ * must stay where it is.
+ */
+bool
+macro_set_stored(uint8_t key, const uint8_t *data, uint8_t size, bool packed)
+{
+    int16_t len = macro_count(data, size, packed);
+
+    if ((key > (MACRO_MAXKEYS - 1)) || (len < 0)) {
+        return false;
+    }
+
+    macros[key].data = data;
+    macros[key].size = size;
+    macros[key].len = len;
+    macros[key].packed = packed;
+    return true;
+}
+
+/*
+ * Whether stored data holds the events of the macro
+ */
+bool
+macro_is_stored(uint8_t key, const uint8_t *data, uint8_t size, bool packed)
+{
+    const uint8_t *current = macros[key].data;
+    event_t stored, event;
+    uint8_t i;
+
+    if ((key > (MACRO_MAXKEYS - 1)) ||
+        (macro_count(data, size, packed) != macros[key].len)) {
+        return false;
+    }
+
+    for (i = 0; i < macros[key].len; i++) {
+        data = macro_next(data, packed, &stored);
+        current = macro_next(current, macros[key].packed, &event);
+        if (memcmp(&stored, &event, sizeof(event_t))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+macro_get_event(uint8_t key, uint8_t position, event_t *event)
+{
+    const uint8_t *data;
+
+    if ((key > (MACRO_MAXKEYS - 1)) || (position >= macros[key].len)) {
+        return false;
+    }
+
+    data = macros[key].data;
+
+    if (! macros[key].packed) {
+        memcpy(event, data + (position * sizeof(event_t)), sizeof(event_t));
+        return true;
+    }
+
+    do {
+        data = macro_next(data, true, event);
+    } while (position--);
+
+    return true;
+}
+
 void
 macro_event(event_t *event, bool pressed)
 {
-    elog("macro %02x %d", event->macro.number, pressed);
+    elog_debug("macro %02x %d", event->macro.number, pressed);
 
     if (pressed) {
         macro_key = event->macro.number;
@@ -112,20 +269,25 @@ macro_event(event_t *event, bool pressed)
 void
 macro_run()
 {
-    event_t *event;
+    event_t event;
 
     if (macro_active) {
         led_state(MACRO_LED_ACTIVE);
-        event = &macro_buffer[macro_key][macro_position];
+        if (! macro_get_event(macro_key, macro_position, &event)) {
+            macro_active = 0;
+            led_clear(MACRO_LED_ACTIVE);
+            light_set_macro(0);
+            return;
+        }
         switch (macro_operation) {
             case MACRO_INIT:
-                if (send_event_if_idle(event, 1)) {
+                if (send_event_if_idle(&event, 1)) {
                     macro_operation = MACRO_PRESSED;
                 }
                 break;
 
             case MACRO_PRESSED:
-                if (send_event_if_idle(event, 0)) {
+                if (send_event_if_idle(&event, 0)) {
                     macro_operation = MACRO_UNPRESSED;
                 }
                 break;
@@ -133,7 +295,7 @@ macro_run()
             case MACRO_UNPRESSED:
                 macro_operation = MACRO_INIT;
                 macro_position++;
-                if (macro_position >= macro_len[macro_key]) {
+                if (macro_position >= macros[macro_key].len) {
                     macro_active = 0;
                     led_clear(MACRO_LED_ACTIVE);
                     light_set_macro(0);
@@ -27,17 +27,35 @@
 #ifndef _MACRO_H
 #define _MACRO_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
 #include "keymap.h"
 
+/*
+ * A macro is played from where it is stored: its record in flash, or a
+ * ram overlay slot while it is changed and not saved yet. Its events are
+ * either stored as is, or packed as a byte per event: the character that
+ * types it, or MACRO_ESCAPE followed by the event.
+ */
+#define MACRO_ESCAPE          0xff
+
+typedef struct {
+    const uint8_t *data;
+    uint8_t size;
+    uint8_t len;
+    bool packed;
+} macro_t;
+
 extern volatile uint8_t macro_active;
-extern event_t macro_buffer[MACRO_MAXKEYS][MACRO_MAXLEN];
-extern uint8_t macro_len[MACRO_MAXKEYS];
+extern macro_t macros[MACRO_MAXKEYS];
 
 void macro_init(void);
 void macro_set_phrase(uint8_t key, uint8_t *phrase, uint8_t size);
+bool macro_set_stored(uint8_t key, const uint8_t *data, uint8_t size, bool packed);
+bool macro_is_stored(uint8_t key, const uint8_t *data, uint8_t size, bool packed);
+bool macro_get_event(uint8_t key, uint8_t position, event_t *event);
 void macro_event(event_t *event, bool pressed);
 void macro_run(void);
 
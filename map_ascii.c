@@ -26,14 +26,18 @@
  */
 
 /*
- * Map from ascii characters 0x20 - 0x7e to events
+ * Map from ascii characters 0x20 - 0x7e, tab and newline to events
  */
 #include <stddef.h>
+#include <string.h>
 
 #include "keymap.h"
 #include "map_ascii.h"
 #include "usb_keycode.h"
 
+static event_t translate_tab = _K(TAB);
+static event_t translate_newline = _K(ENTER);
+
 event_t translate_ascii[] =
 {
     _K(SPACE),                  /* 0x20   */
@@ -150,5 +154,38 @@ event_t
         return &translate_ascii[offset];
     }
 
+    if (c == '\t') {
+        return &translate_tab;
+    }
+
+    if (c == '\n') {
+        return &translate_newline;
+    }
+
     return NULL;
 }
+
+/*
+ * The character that maps to event, or -1 if there is none
+ */
+int16_t
+map_ascii_from_event(const event_t *event)
+{
+    uint8_t c;
+
+    for (c = 0x20; c <= 0x7e; c++) {
+        if (! memcmp(event, &translate_ascii[c - 0x20], sizeof(event_t))) {
+            return c;
+        }
+    }
+
+    if (! memcmp(event, &translate_tab, sizeof(event_t))) {
+        return '\t';
+    }
+
+    if (! memcmp(event, &translate_newline, sizeof(event_t))) {
+        return '\n';
+    }
+
+    return -1;
+}
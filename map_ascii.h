@@ -29,5 +29,6 @@
 #define _MAP_ASCII
 
 event_t *map_ascii_to_event(uint8_t c);
+int16_t map_ascii_from_event(const event_t *event);
 
 #endif /* _MAP_ASCII */
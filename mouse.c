@@ -34,23 +34,81 @@
 
 #include "mouse.h"
 
+#define RESOLUTION_WHEEL    0b0011
+#define RESOLUTION_PAN      0b1100
+
 report_mouse_t mouse_state;
 uint8_t mouse_idle = 0;
 
+/*
+ * Resolution multiplier feature as set by the host, and the scroll amounts
+ * that still need to be sent; both in 1/WHEEL_MULTIPLIER detents.
+ */
+static uint8_t mouse_resolution = 0;
+static int16_t wheel_h = 0;
+static int16_t wheel_v = 0;
+
 report_mouse_t *
 mouse_report()
 {
     return &mouse_state;
 }
 
+uint8_t *
+mouse_get_resolution()
+{
+    return &mouse_resolution;
+}
+
 void
-mouse_event(event_t *event, bool pressed)
+mouse_set_resolution(uint8_t resolution)
 {
-    if (pressed) {
-        mouse_state.buttons = event->mouse.button;
-        mouse_state.x = event->mouse.x;
-        mouse_state.y = event->mouse.y;
-        mouse_state.h = mouse_state.v = 0;
+    mouse_resolution = resolution;
+}
+
+/*
+ * Take as much of the pending scroll amount as fits in one report. Without
+ * high resolution, only whole detents are taken; the remainder waits until
+ * enough has been gathered.
+ */
+static int8_t
+wheel_take(int16_t *pending, bool hires)
+{
+    int16_t amount = *pending;
+
+    if (! hires) {
+        amount /= WHEEL_MULTIPLIER;
+    }
+    if (amount > 127) {
+        amount = 127;
+    } else if (amount < -127) {
+        amount = -127;
+    }
+    *pending -= hires ? amount : (amount * WHEEL_MULTIPLIER);
+
+    return (int8_t)amount;
+}
+
+/*
+ * Send any pending scroll amount once the mouse endpoint is free
+ */
+void
+mouse_process()
+{
+    int8_t h, v;
+
+    if ((! (wheel_h || wheel_v)) ||
+        (! usb_ep_mouse_idle)) {
+        return;
+    }
+
+    h = wheel_take(&wheel_h, mouse_resolution & RESOLUTION_PAN);
+    v = wheel_take(&wheel_v, mouse_resolution & RESOLUTION_WHEEL);
+
+    if (h || v) {
+        mouse_state.h = h;
+        mouse_state.v = v;
+        mouse_state.x = mouse_state.y = 0;
         usb_update_mouse(&mouse_state);
     }
 }
@@ -60,9 +118,18 @@ wheel_event(event_t *event, bool pressed)
 {
     if (pressed) {
         mouse_state.buttons = event->wheel.button;
-        mouse_state.h = event->wheel.h;
-        mouse_state.v = event->wheel.v;
-        mouse_state.x = mouse_state.y = 0;
-        usb_update_mouse(&mouse_state);
+        wheel_scroll(event->wheel.h * WHEEL_MULTIPLIER,
+                     event->wheel.v * WHEEL_MULTIPLIER);
     }
 }
+
+/*
+ * Scroll by h, v in 1/WHEEL_MULTIPLIER detents
+ */
+void
+wheel_scroll(int16_t h, int16_t v)
+{
+    wheel_h += h;
+    wheel_v += v;
+    mouse_process();
+}
@@ -41,7 +41,10 @@ extern report_mouse_t mouse_state;
 #define MOUSE_BUTTON5  (1<<4)
 
 report_mouse_t *mouse_report(void);
-void mouse_event(event_t *event, bool pressed);
+uint8_t *mouse_get_resolution(void);
+void mouse_set_resolution(uint8_t resolution);
+void mouse_process(void);
 void wheel_event(event_t *event, bool pressed);
+void wheel_scroll(int16_t h, int16_t v);
 
 #endif /* _MOUSE_H */
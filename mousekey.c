@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mousekey
+ *
+ * Move the pointer for as long as a mouse key is held. Motion is sent once
+ * every MS_MOUSEKEY, which matches the mouse endpoint interval. Several
+ * held keys add up, so holding up and right moves diagonally. Speed grows
+ * over time following the acceleration curve chosen by the key.
+ */
+
+#include <stddef.h>
+
+#include "clock.h"
+#include "config.h"
+#include "elog.h"
+#include "mouse.h"
+#include "mousekey.h"
+
+#define ELOG_MODULE ELOG_MOUSEKEY
+
+#define MOUSEKEY_NUM        4
+
+/*
+ * Acceleration curve:
+ * - delay: ticks after the first step before motion repeats
+ * - ramp:  ticks to go from 1x to max speed
+ * - max:   top speed multiplier
+ */
+typedef struct {
+    uint8_t delay;
+    uint8_t ramp;
+    uint8_t max;
+} mousekey_curve_t;
+
+static const mousekey_curve_t curves[MOUSEKEY_CURVES_NUM] = {
+    [MOUSEKEY_CURVE_DEFAULT]  = { .delay = 3,  .ramp = 50,  .max = 8  },
+    [MOUSEKEY_CURVE_CONSTANT] = { .delay = 3,  .ramp = 0,   .max = 1  },
+    [MOUSEKEY_CURVE_FAST]     = { .delay = 2,  .ramp = 20,  .max = 16 },
+    [MOUSEKEY_CURVE_PRECISE]  = { .delay = 10, .ramp = 100, .max = 4  },
+};
+
+typedef struct {
+    uint8_t active;
+    uint8_t button;
+    int8_t x;
+    int8_t y;
+    uint16_t ticks;
+} mousekey_t;
+
+static mousekey_t held[MOUSEKEY_NUM];
+static uint32_t mousekey_timer = 0;
+
+/* Motion not yet sent, in 1/16th of a step */
+static int16_t remainder_x = 0;
+static int16_t remainder_y = 0;
+
+/*
+ * Speed multiplier for a key held for a number of ticks, in 1/16ths
+ */
+static uint16_t
+mousekey_speed(mousekey_t *key)
+{
+    const mousekey_curve_t *curve;
+    uint16_t t;
+
+    curve = &curves[(key->button >> MOUSEKEY_CURVE_SHIFT) % MOUSEKEY_CURVES_NUM];
+
+    if (key->ticks == 0) {
+        return 16;
+    }
+    if (key->ticks < curve->delay) {
+        return 0;
+    }
+    if (curve->ramp == 0) {
+        return curve->max << 4;
+    }
+
+    t = key->ticks - curve->delay;
+    if (t > curve->ramp) {
+        t = curve->ramp;
+    }
+
+    return 16 + ((((curve->max << 4) - 16) * t) / curve->ramp);
+}
+
+static uint8_t
+mousekey_buttons(void)
+{
+    uint8_t i;
+    uint8_t buttons = 0;
+
+    for (i = 0; i < MOUSEKEY_NUM; i++) {
+        if (held[i].active) {
+            buttons |= (held[i].button & MOUSEKEY_BUTTONS);
+        }
+    }
+    return buttons;
+}
+
+static bool
+mousekey_moving(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MOUSEKEY_NUM; i++) {
+        if (held[i].active && (held[i].x || held[i].y)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int8_t
+mousekey_clamp(int32_t v)
+{
+    if (v > 127) {
+        return 127;
+    } else if (v < -127) {
+        return -127;
+    }
+    return (int8_t)v;
+}
+
+/*
+ * Keep only the fraction of a step that was not sent; motion beyond what
+ * fits in a report is dropped, not carried over
+ */
+static int16_t
+mousekey_fraction(int32_t v, int8_t sent)
+{
+    v -= sent * 16;
+    if (v > 15) {
+        return 15;
+    } else if (v < -15) {
+        return -15;
+    }
+    return (int16_t)v;
+}
+
+/*
+ * Send one report with the combined motion of all held keys. Returns
+ * whether there is any motion left to send in later ticks.
+ */
+static bool
+mousekey_move(void)
+{
+    uint8_t i;
+    uint16_t speed;
+    int32_t x = remainder_x;
+    int32_t y = remainder_y;
+    bool moving = false;
+
+    for (i = 0; i < MOUSEKEY_NUM; i++) {
+        if (held[i].active && (held[i].x || held[i].y)) {
+            speed = mousekey_speed(&held[i]);
+            x += held[i].x * speed;
+            y += held[i].y * speed;
+            if (held[i].ticks < UINT16_MAX) {
+                held[i].ticks++;
+            }
+            moving = true;
+        }
+    }
+
+    mouse_state.buttons = mousekey_buttons();
+    mouse_state.x = mousekey_clamp(x / 16);
+    mouse_state.y = mousekey_clamp(y / 16);
+    mouse_state.h = mouse_state.v = 0;
+    remainder_x = mousekey_fraction(x, mouse_state.x);
+    remainder_y = mousekey_fraction(y, mouse_state.y);
+
+    if (mouse_state.x || mouse_state.y) {
+        usb_update_mouse(&mouse_state);
+    }
+
+    return moving;
+}
+
+void
+mousekey_event(event_t *event, bool pressed)
+{
+    uint8_t i;
+    mousekey_t *key = NULL;
+
+    elog_debug("mousekey %02x %d %d %d", event->mouse.button, event->mouse.x,
+               event->mouse.y, pressed);
+
+    /*
+     * Keys are matched on their content, so a release still finds its
+     * press if the layer changed in between
+     */
+    for (i = 0; i < MOUSEKEY_NUM; i++) {
+        if (held[i].active &&
+            (held[i].button == event->mouse.button) &&
+            (held[i].x == event->mouse.x) &&
+            (held[i].y == event->mouse.y)) {
+            key = &held[i];
+            break;
+        }
+    }
+
+    if (pressed) {
+        if (key) {
+            return;
+        }
+        for (i = 0; i < MOUSEKEY_NUM; i++) {
+            if (! held[i].active) {
+                key = &held[i];
+                break;
+            }
+        }
+        if (! key) {
+            elog_warn("mousekey too many keys held");
+            return;
+        }
+        key->active = true;
+        key->button = event->mouse.button;
+        key->x = event->mouse.x;
+        key->y = event->mouse.y;
+        key->ticks = 0;
+    } else {
+        if (! key) {
+            return;
+        }
+        key->active = false;
+        if (! mousekey_moving()) {
+            remainder_x = remainder_y = 0;
+        }
+    }
+
+    if (pressed && (key->x || key->y)) {
+        /*
+         * mousekey_process sends the first step once the endpoint is idle,
+         * then repeats on the tick
+         */
+        mousekey_timer = 0;
+    } else if (mouse_state.buttons != mousekey_buttons()) {
+        mouse_state.buttons = mousekey_buttons();
+        mouse_state.x = mouse_state.y = 0;
+        mouse_state.h = mouse_state.v = 0;
+        usb_update_mouse(&mouse_state);
+    }
+}
+
+void
+mousekey_process()
+{
+    if (! timer_passed(mousekey_timer)) {
+        return;
+    }
+
+    if (! usb_ep_mouse_idle) {
+        return;
+    }
+
+    if (mousekey_move()) {
+        mousekey_timer = timer_set(MS_MOUSEKEY);
+    } else {
+        /* Nothing held that moves; wait for the next press */
+        mousekey_timer = UINT32_MAX;
+    }
+}
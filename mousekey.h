@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MOUSEKEY_H
+#define _MOUSEKEY_H
+
+#include <stdint.h>
+#include "keymap.h"
+
+/*
+ * The button byte of a mouse event holds the buttons in the lower bits,
+ * and the acceleration curve to use for x, y motion in the upper bits.
+ */
+#define MOUSEKEY_BUTTONS          0x1f
+#define MOUSEKEY_CURVE_SHIFT      5
+#define MOUSEKEY_CURVE(Curve)     ((Curve) << MOUSEKEY_CURVE_SHIFT)
+
+enum {
+    MOUSEKEY_CURVE_DEFAULT = 0,
+    MOUSEKEY_CURVE_CONSTANT,
+    MOUSEKEY_CURVE_FAST,
+    MOUSEKEY_CURVE_PRECISE,
+    MOUSEKEY_CURVES_NUM
+};
+
+void mousekey_event(event_t *event, bool pressed);
+void mousekey_process(void);
+
+#endif /* _MOUSEKEY_H */
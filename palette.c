@@ -28,6 +28,9 @@
 #include "elog.h"
 #include "palette.h"
 #include "serial.h"
+#include "stage.h"
+
+#define ELOG_MODULE ELOG_PALETTE
 
 hsv_t palette[PALETTE_NUM] = {
     HSV_BLACK,
@@ -91,19 +94,29 @@ const hsv_t hsv_cerise        = HSV_CERISE;
 const hsv_t hsv_rose          = HSV_ROSE;
 const hsv_t hsv_crimson       = HSV_CRIMSON;
 
-void
-palette_dump()
+/*
+ * Dump generator; a header line followed by a line per color
+ */
+bool
+palette_dump(uint16_t index)
 {
-    uint8_t i;
+    if (index > PALETTE_NUM) {
+        return false;
+    }
 
-    printfnl("palette:");
-    for (i = 0; i < PALETTE_NUM; i++) {
-        printfnl("hsv %02x: %04x,%02x,%02x",
-               i,
-               palette[i].h,
-               palette[i].s,
-               palette[i].v);
+    if (index == 0) {
+        printfnl("palette:");
+        return true;
     }
+
+    index--;
+    printfnl("hsv %02x: %04x,%02x,%02x",
+             index,
+             palette[index].h,
+             palette[index].s,
+             palette[index].v);
+
+    return true;
 }
 
 hsv_t
@@ -117,8 +130,8 @@ void
 palette_set(uint8_t color, hsv_t hsv)
 {
     if (color >= PALETTE_NUM) {
-        elog("palette color out of bounds");
+        elog_error("palette color out of bounds");
         return;
     }
-    palette[color] = hsv;
+    *stage_palette(color) = hsv;
 }
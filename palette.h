@@ -27,6 +27,9 @@
 #ifndef _PALETTE_H
 #define _PALETTE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "rgbmap.h"
 
 /*
@@ -166,7 +169,7 @@ enum {
 
 extern hsv_t palette[PALETTE_NUM];
 
-void palette_dump(void);
+bool palette_dump(uint16_t index);
 hsv_t palette_get(uint8_t color);
 void palette_set(uint8_t color, hsv_t hsv);
 #endif
@@ -2,10 +2,31 @@
  * Simple ringbuffer implementation from open-bldc's libgovernor that
  * you can find at:
  * https://github.com/open-bldc/open-bldc/tree/master/source/libgovernor
+ *
+ * Sizes are a power of two, so positions wrap with a mask instead of a
+ * modulo, and blocks are copied in at most two contiguous spans.
+ *
+ * The reserve/commit calls at the end allow several producers in different
+ * interrupt levels to share one ring without disabling interrupts.
  *****************************************************************************/
 
+#include <string.h>
+
+#include <libopencm3/cm3/sync.h>
+
 #include "ring.h"
 
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+/*
+ * libopencm3 wraps ldrex and strex, but not clrex
+ */
+static inline void
+__clrex(void)
+{
+    __asm__ volatile ("clrex" : : : "memory");
+}
+#endif
+
 void
 ring_init(ring_t *ring, uint8_t *buf, ring_size_t size)
 {
@@ -13,14 +34,18 @@ ring_init(ring_t *ring, uint8_t *buf, ring_size_t size)
     ring->size = size;
     ring->begin = 0;
     ring->end = 0;
+    ring->reserve = 0;
+    ring->writers = 0;
 }
 
 int32_t
 ring_write_ch(ring_t *ring, uint8_t ch)
 {
-    if (((ring->end + 1) % ring->size) != ring->begin) {
-        ring->data[ring->end++] = ch;
-        ring->end %= ring->size;
+    uint32_t next = (ring->end + 1) & RING_MASK(ring);
+
+    if (next != ring->begin) {
+        ring->data[ring->end] = ch;
+        ring->end = next;
         return (uint32_t)ch;
     }
 
@@ -30,14 +55,23 @@ ring_write_ch(ring_t *ring, uint8_t ch)
 int32_t
 ring_write(ring_t *ring, uint8_t *data, ring_size_t size)
 {
-    int32_t i;
+    int32_t len = RING_FREE(ring);
+    int32_t first;
 
-    for (i = 0; i < size; i++) {
-        if (ring_write_ch(ring, data[i]) < 0)
-            return -i;
+    if (len > size) {
+        len = size;
     }
 
-    return i;
+    first = ring->size - ring->end;
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(&ring->data[ring->end], data, first);
+    memcpy(&ring->data[0], data + first, len - first);
+    ring->end = (ring->end + len) & RING_MASK(ring);
+
+    return (len == size) ? len : -len;
 }
 
 int32_t
@@ -46,8 +80,8 @@ ring_read_ch(ring_t *ring, uint8_t *ch)
     int32_t ret = -1;
 
     if (ring->begin != ring->end) {
-        ret = ring->data[ring->begin++];
-        ring->begin %= ring->size;
+        ret = ring->data[ring->begin];
+        ring->begin = (ring->begin + 1) & RING_MASK(ring);
         if (ch)
             *ch = ret;
     }
@@ -55,45 +89,46 @@ ring_read_ch(ring_t *ring, uint8_t *ch)
     return ret;
 }
 
+int32_t
+ring_peek_ch(ring_t *ring, uint8_t *ch)
+{
+    if (ring->begin == ring->end) {
+        return -1;
+    }
+
+    *ch = ring->data[ring->begin];
+
+    return *ch;
+}
+
 int32_t
 ring_read(ring_t *ring, uint8_t *data, ring_size_t size)
 {
-    int32_t i;
+    int32_t len = RING_USED(ring);
+    int32_t first;
 
-    for (i = 0; i < size; i++) {
-        if (ring_read_ch(ring, data + i) < 0)
-            return i;
+    if (len > size) {
+        len = size;
     }
 
-    return -i;
+    first = ring->size - ring->begin;
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(data, &ring->data[ring->begin], first);
+    memcpy(data + first, &ring->data[0], len - first);
+    ring->begin = (ring->begin + len) & RING_MASK(ring);
+
+    return (len == size) ? -len : len;
 }
 
 int32_t
 ring_read_contineous(ring_t *ring, uint8_t **data, ring_size_t maxlen)
 {
-    int32_t i;
-
-    *data = &ring->data[ring->begin];
+    int32_t i = ring_peek_contineous(ring, data, maxlen);
 
-    if (ring->begin == ring->end) {
-        return 0;
-    } else if (ring->begin > ring->end) {
-        i = ring->size - ring->begin;
-        if (i > maxlen) {
-            ring->begin += maxlen;
-            i = maxlen;
-        } else {
-            ring->begin = 0;
-        }
-    } else if (ring->begin < ring->end) {
-        i = ring->end - ring->begin;
-        if (i > maxlen) {
-            ring->begin += maxlen;
-            i = maxlen;
-        } else {
-            ring->begin = ring->end;
-        }
-    }
+    ring->begin = (ring->begin + i) & RING_MASK(ring);
 
     return i;
 }
@@ -107,7 +142,7 @@ ring_mark(ring_t *ring)
 uint32_t
 ring_marklen(ring_t *ring, uint32_t mark)
 {
-    return (((ring->end - mark) + ring->size) % ring->size);
+    return (ring->end - mark) & RING_MASK(ring);
 }
 
 void
@@ -122,3 +157,109 @@ ring_skip_line(struct ring *ring)
         }
     }
 }
+
+/*
+ * Claim size bytes for a record. Returns the position to ring_put the record
+ * at, or -1 if it does not fit; ring_commit must follow in both cases.
+ *
+ * An interrupt that preempts a producer always finishes before that
+ * producer resumes. The reserved area is therefore completely written when
+ * the last of the nested producers commits, and only then is it published
+ * to the consumer by moving end up to reserve.
+ */
+int32_t
+ring_reserve(ring_t *ring, ring_size_t size)
+{
+    uint32_t pos, used;
+
+    do {
+        used = __ldrex(&ring->writers);
+    } while (__strex(used + 1, &ring->writers));
+
+    do {
+        pos = __ldrex(&ring->reserve);
+        used = (pos - ring->begin) & RING_MASK(ring);
+        if ((uint32_t)size > RING_SIZE(ring) - used) {
+            /* Drop the exclusive reservation that no strex will close */
+            __clrex();
+            return -1;
+        }
+    } while (__strex((pos + size) & RING_MASK(ring), &ring->reserve));
+
+    return pos;
+}
+
+void
+ring_put(ring_t *ring, uint32_t pos, uint8_t *data, ring_size_t size)
+{
+    int32_t first = ring->size - pos;
+
+    if (first > size) {
+        first = size;
+    }
+
+    memcpy(&ring->data[pos], data, first);
+    memcpy(&ring->data[0], data + first, size - first);
+}
+
+void
+ring_commit(ring_t *ring)
+{
+    uint32_t writers, reserve;
+
+    /* Record data must be visible before end moves past it */
+    __dmb();
+
+    do {
+        writers = __ldrex(&ring->writers) - 1;
+    } while (__strex(writers, &ring->writers));
+
+    if (writers == 0) {
+        /*
+         * A producer preempting us here reserves and commits a record of
+         * its own; the exception return clears the exclusive monitor, so we
+         * retry and publish its record along with ours.
+         */
+        do {
+            __ldrex(&ring->end);
+            reserve = ring->reserve;
+        } while (__strex(reserve, &ring->end));
+    }
+}
+
+/*
+ * Consumer side of a multi-producer ring: the data stays claimed until it is
+ * released, so producers cannot overwrite it while it is being sent.
+ */
+int32_t
+ring_peek_contineous(ring_t *ring, uint8_t **data, ring_size_t maxlen)
+{
+    uint32_t begin = ring->begin;
+    uint32_t end = ring->end;
+    int32_t i;
+
+    __dmb();
+
+    *data = &ring->data[begin];
+
+    if (begin == end) {
+        return 0;
+    } else if (begin > end) {
+        i = ring->size - begin;
+    } else {
+        i = end - begin;
+    }
+
+    if (i > maxlen) {
+        i = maxlen;
+    }
+
+    return i;
+}
+
+void
+ring_release(ring_t *ring, ring_size_t size)
+{
+    __dmb();
+    ring->begin = (ring->begin + size) & RING_MASK(ring);
+}
@@ -32,25 +32,46 @@
 
 typedef int32_t ring_size_t;
 
+/*
+ * Ring sizes must be a power of two; a ring holds up to size - 1 bytes.
+ *
+ * Plain rings have one producer and one consumer. Rings written through
+ * ring_reserve/ring_commit may have producers in any interrupt level;
+ * reserve is the claimed end, end the published one and writers the number
+ * of producers in between.
+ */
 typedef struct ring {
     uint8_t *data;
     ring_size_t size;
-    uint32_t begin;
-    uint32_t end;
+    volatile uint32_t begin;
+    volatile uint32_t end;
+    volatile uint32_t reserve;
+    volatile uint32_t writers;
 } ring_t;
 
 #define RING_SIZE(RING)  ((RING)->size - 1)
+#define RING_MASK(RING)  ((uint32_t)(RING)->size - 1)
 #define RING_DATA(RING)  (RING)->data
 #define RING_EMPTY(RING) ((RING)->begin == (RING)->end)
+#define RING_USED(RING)  ((int32_t)(((RING)->end - (RING)->begin) & RING_MASK(RING)))
+#define RING_FREE(RING)  (RING_SIZE(RING) - RING_USED(RING))
+#define RING_UNRESERVED(RING) \
+    (RING_SIZE(RING) - (int32_t)(((RING)->reserve - (RING)->begin) & RING_MASK(RING)))
 
 void ring_init(ring_t *ring, uint8_t *buf, ring_size_t size);
 int32_t ring_write_ch(ring_t *ring, uint8_t ch);
 int32_t ring_write(ring_t *ring, uint8_t *data, ring_size_t size);
 int32_t ring_read_ch(ring_t *ring, uint8_t *ch);
+int32_t ring_peek_ch(ring_t *ring, uint8_t *ch);
 int32_t ring_read(ring_t *ring, uint8_t *data, ring_size_t size);
 int32_t ring_read_contineous(ring_t *ring, uint8_t **data, ring_size_t maxlen);
 uint32_t ring_mark(ring_t *ring);
 uint32_t ring_marklen(ring_t *ring, uint32_t mark);
 void ring_skip_line(struct ring *ring);
+int32_t ring_reserve(ring_t *ring, ring_size_t size);
+void ring_put(ring_t *ring, uint32_t pos, uint8_t *data, ring_size_t size);
+void ring_commit(ring_t *ring);
+int32_t ring_peek_contineous(ring_t *ring, uint8_t **data, ring_size_t maxlen);
+void ring_release(ring_t *ring, ring_size_t size);
 
 #endif /* _RING_H */
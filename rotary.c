@@ -26,6 +26,7 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <libopencm3/stm32/rcc.h>
@@ -35,10 +36,14 @@
 #include "elog.h"
 #include "keymap.h"
 #include "layer.h"
+#include "mouse.h"
 #include "rgbease.h"
 #include "rotary.h"
+#include "stage.h"
 #include "usb_keycode.h"
 
+#define ELOG_MODULE ELOG_ROTARY
+
 static event_t *last_event = NULL;
 volatile uint16_t rotary_value = 0;
 
@@ -68,51 +73,67 @@ void
 rotary_process(void)
 {
     uint16_t current = timer_get_counter(ROT_TIM);
-    uint8_t direction = ROTARY_NONE;
+    int16_t delta = (int16_t)(current - rotary_value);
+    uint8_t direction;
+    int16_t amount;
     event_t *event;
 
     if (last_event) {
         if (send_event_if_idle(last_event, 0)) {
             last_event = NULL;
         }
-    } else {
-        if (current > rotary_value) {
-            direction = ROTARY_FORWARD;
-        } else if (current < rotary_value) {
-            direction = ROTARY_BACKWARD;
-        }
-
-        if (direction != ROTARY_NONE) {
-            elog("count = %d", current);
-            event = &rotary[layer][direction];
-            if (send_event_if_idle(event, 1)) {
-                last_event = event;
-                rgbease_rotate(direction);
-            }
+    } else if (delta) {
+        direction = (delta > 0) ? ROTARY_FORWARD : ROTARY_BACKWARD;
+        elog_debug("count = %d", current);
+        event = &rotary[layer][direction];
+
+        if (event->type == KMT_WHEEL) {
+            /*
+             * Wheel events scroll by the full distance turned, in
+             * fractions of a detent; the mouse module keeps whatever
+             * does not fit the current report.
+             */
+            amount = (abs(delta) * WHEEL_MULTIPLIER) / ROT_COUNTS_DETENT;
+            wheel_scroll(amount * event->wheel.h, amount * event->wheel.v);
+            rgbease_rotate(direction);
+        } else if (send_event_if_idle(event, 1)) {
+            last_event = event;
+            rgbease_rotate(direction);
         }
     }
 
     rotary_value = current;
 }
 
-void
-rotary_dump()
+/*
+ * Dump generator; per layer a header line followed by a line per direction
+ */
+bool
+rotary_dump(uint16_t index)
 {
-    uint8_t l, d;
+    uint8_t l = index / (ROTARY_NUM + 1);
+    uint8_t d = index % (ROTARY_NUM + 1);
     event_t *e;
 
-    for (l = 0; l < LAYERS_NUM; l++) {
+    if (l >= LAYERS_NUM) {
+        return false;
+    }
+
+    if (d == 0) {
         printfnl("layer %02x", l);
-        for (d = 0; d < ROTARY_NUM; d++) {
-            e = &rotary[l][d];
-            printfnl("rotary %02x: %01x,%02x,%02x,%02x",
-                     d,
-                     e->type,
-                     e->args.num1,
-                     e->args.num2,
-                     e->args.num3);
-        }
+        return true;
     }
+
+    d--;
+    e = &rotary[l][d];
+    printfnl("rotary %02x: %01x,%02x,%02x,%02x",
+             d,
+             e->type,
+             e->args.num1,
+             e->args.num2,
+             e->args.num3);
+
+    return true;
 }
 
 void
@@ -120,9 +141,9 @@ rotary_set(uint8_t l, uint8_t d, event_t *event)
 {
     if ((l >= LAYERS_NUM) ||
         (d >= ROTARY_NONE)) {
-        elog("rotary position out of bounds");
+        elog_error("rotary position out of bounds");
         return;
     }
 
-    memcpy(&rotary[l][d], event, sizeof(event_t));
+    memcpy(stage_rotary(l, d), event, sizeof(event_t));
 }
@@ -28,6 +28,7 @@
 #ifndef _ROTARY_H
 #define _ROTARY_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "keymap.h"
 
@@ -43,7 +44,7 @@ extern volatile uint16_t rotary_value;
 
 void rotary_init(void);
 void rotary_process(void);
-void rotary_dump(void);
+bool rotary_dump(uint16_t index);
 void rotary_set(uint8_t layer, uint8_t direction, event_t *event);
 
 #endif
@@ -66,44 +66,326 @@
 
 #include <string.h>
 #include <stdarg.h>
+
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scb.h>
+
+#include "clock.h"
 #include "config.h"
 #include "ring.h"
 #include "serial.h"
 #include "command.h"
+#include "dump.h"
+#include "elog.h"
+#include "frame.h"
+#include "flash.h"
+
+#define ELOG_MODULE ELOG_COMMAND
+
+#if (SERIAL_BUF_SIZEIN & (SERIAL_BUF_SIZEIN - 1)) || (SERIAL_BUF_SIZEOUT & (SERIAL_BUF_SIZEOUT - 1))
+#error SERIAL_BUF_SIZEIN and SERIAL_BUF_SIZEOUT must be a power of two
+#endif
+
+#define SERIAL_BENCH_LINES 100
 
 static struct ring output_ring;
 static struct ring input_ring;
+static struct ring line_ring;
 static uint8_t input_buffer[SERIAL_BUF_SIZEIN];
+static uint8_t line_buffer[SERIAL_BUF_SIZEIN];
 static uint8_t output_buffer[SERIAL_BUF_SIZEOUT];
+static uint32_t output_count;
+static bool command_pending;
+static bool line_discard;
 bool serial_active;
 
+/*
+ * Output is gathered per line and committed to the output ring as one
+ * record, so lines from the main loop and from interrupts never interleave.
+ * The main loop keeps its line across printf calls until the newline;
+ * interrupts format into a line on their stack that is committed when the
+ * call returns.
+ */
+struct serial_line {
+    struct ring *ring;
+    uint16_t len;
+    uint16_t count;
+    bool start;
+    bool tagged;
+    uint8_t data[SERIAL_LINE_MAX];
+};
+
+static struct serial_line main_line = {
+    .ring = &output_ring,
+    .start = true,
+    .tagged = true,
+};
+
+/*
+ * Tag of the command being executed, or -1. While set, every line of the
+ * main loop starts with "@tt " so a host can route it back to the requester.
+ */
+static int16_t serial_tag = -1;
+
 void
 serial_init()
 {
     ring_init(&output_ring, output_buffer, SERIAL_BUF_SIZEOUT);
     ring_init(&input_ring, input_buffer, SERIAL_BUF_SIZEIN);
+    ring_init(&line_ring, line_buffer, SERIAL_BUF_SIZEIN);
     serial_active = false;
 }
 
-void
+/*
+ * Whether the input has room for another packet
+ */
+bool
+serial_in_room()
+{
+    return (RING_FREE(&input_ring) >= EP_SIZE_SERIALDATAOUT);
+}
+
+/*
+ * Called from the usb interrupt; only queue the data. Returns true when
+ * there is no room left for another packet, so the host should hold off.
+ */
+bool
 serial_in(uint8_t *buf, uint16_t len)
 {
-    uint16_t i;
-    uint8_t eol = 0;
+    ring_write(&input_ring, buf, len);
+
+    return ! serial_in_room();
+}
+
+/*
+ * Decode queued input from the main loop, for at most MS_COMMAND per call.
+ * Text is gathered into lines that are executed as a whole; a FRAME_STX
+ * starts a binary frame, which is decoded as its bytes come in.
+ *
+ * Input is left queued while a dump is being sent, and a line that started
+ * a dump is finished once the dump is done. It is also left queued while
+ * an imported piece of configuration is being programmed.
+ */
+void
+serial_process()
+{
+    uint32_t budget = timer_set(MS_COMMAND);
     uint8_t c;
 
-    for (i = 0; i < len; i++) {
-        c = *(buf + i);
-        ring_write_ch(&input_ring, c);
+    if (dump_active()) {
+        dump_process();
+        return;
+    }
+
+    if (flash_import_busy()) {
+        return;
+    }
+
+    if (command_pending) {
+        command_pending = ! command_process(&line_ring);
+        return;
+    }
+
+    frame_timeout();
+
+    while (ring_read_ch(&input_ring, &c) != -1) {
+        if (frame_active()) {
+            frame_decode(c);
+        } else if (c == FRAME_STX) {
+            /* A frame cancels any partial text line */
+            ring_init(&line_ring, line_buffer, SERIAL_BUF_SIZEIN);
+            line_discard = false;
+            frame_start();
+        } else if (line_discard) {
+            line_discard = (c != '\n') && (c != '\r');
+        } else if ((c != '\n') && (c != '\r') && (RING_FREE(&line_ring) <= 1)) {
+            /* Keep room for the newline; a longer line is dropped whole */
+            elog_error("line longer than %d, dropped", SERIAL_BUF_SIZEIN - 2);
+            ring_init(&line_ring, line_buffer, SERIAL_BUF_SIZEIN);
+            line_discard = true;
+        } else {
+            ring_write_ch(&line_ring, c);
+            if ((c == '\n') || (c == '\r')) {
+                command_pending = ! command_process(&line_ring);
+            }
+        }
+
+        if (dump_active()) {
+            break;
+        }
+
+        if (timer_passed(budget)) {
+            break;
+        }
+    }
+
+    cdcacm_data_rx_resume();
+}
+
+void
+serial_tag_set(int16_t tag)
+{
+    serial_tag = tag;
+}
+
+int16_t
+serial_tag_get()
+{
+    return serial_tag;
+}
+
+/*
+ * Bytes of main loop output committed so far
+ */
+uint32_t
+serial_output_count()
+{
+    return output_count;
+}
+
+/*
+ * Room left in the output ring, not counting the pending main loop line
+ */
+int32_t
+serial_output_free()
+{
+    return RING_UNRESERVED(&output_ring) - main_line.len;
+}
+
+static bool
+ring_commit_record(struct ring *ring, uint8_t *buf, uint16_t len)
+{
+    int32_t pos = ring_reserve(ring, len);
+
+    if (pos != -1) {
+        ring_put(ring, pos, buf, len);
+    }
+    ring_commit(ring);
+
+    return (pos != -1);
+}
+
+static void
+line_flush(struct serial_line *line)
+{
+    if (line->len) {
+        if (ring_commit_record(line->ring, line->data, line->len) &&
+            (line == &main_line)) {
+            output_count += line->len;
+        }
+        line->len = 0;
+    }
+}
+
+static void
+line_write(struct serial_line *line, const uint8_t *buf, uint16_t len)
+{
+    uint16_t n;
+
+    while (len) {
+        if (line->len == SERIAL_LINE_MAX) {
+            line_flush(line);
+        }
+
+        n = SERIAL_LINE_MAX - line->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&line->data[line->len], buf, n);
+        line->len += n;
+        line->count += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+line_write_ch(struct serial_line *line, uint8_t ch)
+{
+    if (line->len == SERIAL_LINE_MAX) {
+        line_flush(line);
+    }
+    line->data[line->len++] = ch;
+    line->count++;
+}
+
+static void
+line_tag_prefix(struct serial_line *line)
+{
+    uint8_t prefix[4] = { '@', 0, 0, ' ' };
+    static const char hex[] = "0123456789abcdef";
+
+    if (line->start && line->tagged && (serial_tag >= 0)) {
+        prefix[1] = hex[(serial_tag >> 4) & 0xf];
+        prefix[2] = hex[serial_tag & 0xf];
+        line_write(line, prefix, sizeof(prefix));
+    }
+    line->start = false;
+}
+
+/*
+ * End the line; an empty line still gets its tag
+ */
+static void
+line_end(struct serial_line *line)
+{
+    line_tag_prefix(line);
+    line_write(line, (uint8_t *)"\n\r", 2);
+    line_flush(line);
+    line->start = true;
+}
+
+static bool
+serial_in_handler()
+{
+    return (SCB_ICSR & SCB_ICSR_VECTACTIVE) != 0;
+}
+
+/*
+ * Main loop output goes to main_line; an interrupt gets the line passed in,
+ * which lives on its stack.
+ */
+static struct serial_line *
+line_get(struct serial_line *local)
+{
+    if (! serial_in_handler()) {
+        return &main_line;
+    }
+
+    local->ring = &output_ring;
+    local->len = 0;
+    local->count = 0;
+    local->start = true;
+    local->tagged = false;
+
+    return local;
+}
 
-        /* have we seen an end of line */
-        eol |= ((c == '\n') | (c == '\r'));
+static void
+line_put(struct serial_line *line)
+{
+    if (line != &main_line) {
+        line_flush(line);
     }
+}
 
-    if (eol) {
-        /* line received, decode command */
-        command_process(&input_ring);
+/*
+ * Binary output is a record of its own; pending text of the main loop goes
+ * first. Returns whether the record fit.
+ */
+bool
+serial_write(uint8_t *buf, uint16_t len)
+{
+    if (serial_in_handler()) {
+        return ring_commit_record(&output_ring, buf, len);
     }
+
+    line_flush(&main_line);
+    if (! ring_commit_record(&output_ring, buf, len)) {
+        return false;
+    }
+    output_count += len;
+    return true;
 }
 
 void
@@ -113,75 +395,96 @@ serial_out()
     int32_t len;
 
     if (usb_ep_serial_idle) {
-        if (RING_EMPTY(&output_ring))
+        len = ring_peek_contineous(&output_ring, &buf, EP_SIZE_SERIALDATAOUT);
+        if (len == 0)
             return;
 
-        len = ring_read_contineous(&output_ring, &buf, EP_SIZE_SERIALDATAOUT);
         cdcacm_data_wx(buf, len);
+        ring_release(&output_ring, len);
     }
 }
 
-static uint32_t
-itoa(int32_t value, uint32_t radix, uint32_t uppercase, uint32_t unsig,
-     char *buffer, uint32_t zero_pad)
+/*
+ * Format a number straight into the line. The digits are counted first, so
+ * they can be written back to front in place.
+ */
+static void
+line_write_number(struct serial_line *line, uint32_t value, uint32_t radix,
+                  bool uppercase, bool negative, uint32_t zero_pad)
 {
-    char *pbuffer = buffer;
-    int32_t negative = 0;
-    uint32_t i, len;
+    const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    uint32_t v, len, total;
+    uint8_t *p;
 
-    /* No support for unusual radixes. */
-    if (radix > 16)
-        return 0;
+    len = 0;
+    v = value;
+    do {
+        len++;
+        v = (radix == 16) ? (v >> 4) : (v / radix);
+    } while (v);
 
-    if (value < 0 && !unsig) {
-        negative = 1;
-        value = -value;
+    if (len < zero_pad) {
+        len = zero_pad;
+    }
+    total = len + (negative ? 1 : 0);
+    if (total > (uint32_t)(SERIAL_LINE_MAX - line->len)) {
+        line_flush(line);
     }
 
-    /* This builds the string back to front ... */
-    do {
-        int digit = value % radix;
-        *(pbuffer++) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
-        value /= radix;
-    } while (value > 0);
-
-    for (i = (pbuffer - buffer); i < zero_pad; i++)
-        *(pbuffer++) = '0';
-
-    if (negative)
-        *(pbuffer++) = '-';
-
-    *(pbuffer) = '\0';
-
-    /* ... now we reverse it (could do it recursively but will
-     * conserve the stack space) */
-    len = (pbuffer - buffer);
-    for (i = 0; i < len / 2; i++) {
-        char j = buffer[i];
-        buffer[i] = buffer[len-i-1];
-        buffer[len-i-1] = j;
+    p = &line->data[line->len];
+    if (negative) {
+        *p++ = '-';
     }
 
-    return len;
+    p += len;
+    while (len--) {
+        if (radix == 16) {
+            *--p = digits[value & 0xf];
+            value >>= 4;
+        } else {
+            *--p = digits[value % radix];
+            value /= radix;
+        }
+    }
+
+    line->len += total;
+    line->count += total;
 }
 
 static int
-vrprintf(struct ring *ring, const char *fmt, va_list va)
+vlprintf(struct serial_line *line, const char *fmt, va_list va)
 {
-    uint32_t mark = ring_mark(ring);
-    char bf[24];
+    uint16_t count = line->count;
+    const char *span;
     char ch;
+    int32_t value;
+
+    while (*fmt) {
+        /* Copy plain text up to the next conversion or newline at once */
+        span = fmt;
+        while (*fmt && (*fmt != '%') && (*fmt != '\n')) {
+            fmt++;
+        }
+        if (fmt != span) {
+            if (*span != '\r') {
+                line_tag_prefix(line);
+            }
+            line_write(line, (uint8_t *)span, fmt - span);
+        }
+
+        ch = *fmt;
+        if (ch == '\0') {
+            break;
+        }
+        fmt++;
 
-    while ((ch = *(fmt++))) {
         if (ch == '\n') {
-            ring_write_ch(ring, '\n');
-            ring_write_ch(ring, '\r');
-        } else if (ch != '%') {
-            ring_write_ch(ring, ch);
+            line_end(line);
         } else {
-            char zero_pad = 0;
+            uint32_t zero_pad = 0;
             char *ptr;
-            uint32_t len;
+
+            line_tag_prefix(line);
 
             ch = *(fmt++);
 
@@ -200,67 +503,145 @@ vrprintf(struct ring *ring, const char *fmt, va_list va)
                 goto end;
 
             case 'u':
+                line_write_number(line, va_arg(va, uint32_t), 10, false, false, zero_pad);
+                break;
+
             case 'd':
-                len = itoa(va_arg(va, uint32_t), 10, 0, (ch == 'u'), bf, zero_pad);
-                ring_write(ring, (uint8_t *)bf, len);
+                value = va_arg(va, int32_t);
+                line_write_number(line, (value < 0) ? -(uint32_t)value : (uint32_t)value,
+                                  10, false, (value < 0), zero_pad);
                 break;
 
             case 'x':
             case 'X':
-                len = itoa(va_arg(va, uint32_t), 16, (ch == 'X'), 1, bf, zero_pad);
-                ring_write(ring, (uint8_t *)bf, len);
+                line_write_number(line, va_arg(va, uint32_t), 16, (ch == 'X'), false, zero_pad);
                 break;
 
             case 'c' :
-                ring_write_ch(ring, (char)(va_arg(va, int)));
+                line_write_ch(line, (char)(va_arg(va, int)));
                 break;
 
             case 's' :
                 ptr = va_arg(va, char*);
-                ring_write(ring, (uint8_t *)ptr, strlen(ptr));
+                line_write(line, (uint8_t *)ptr, strlen(ptr));
                 break;
 
             default:
-                ring_write_ch(ring, ch);
+                line_write_ch(line, ch);
                 break;
             }
         }
     }
 end:
-    return ring_marklen(ring, mark);
+    return (uint16_t)(line->count - count);
 }
 
+static int
+lprintf(struct serial_line *line, const char *fmt, ...)
+{
+    int ret;
+    va_list va;
+    va_start(va, fmt);
+    ret = vlprintf(line, fmt, va);
+    va_end(va);
+
+    return ret;
+}
 
 int
 printf(const char *fmt, ...)
 {
+    struct serial_line local;
+    struct serial_line *line = line_get(&local);
     int ret;
     va_list va;
+
     va_start(va, fmt);
-    ret = vrprintf(&output_ring, fmt, va);
+    ret = vlprintf(line, fmt, va);
     va_end(va);
 
+    line_put(line);
+
     return ret;
 }
 
 int
 printfnl(const char *fmt, ...)
 {
+    struct serial_line local;
+    struct serial_line *line = line_get(&local);
     int ret;
     va_list va;
-    va_start(va, fmt);
-    ret = vrprintf(&output_ring, fmt, va);
-
-    ring_write_ch(&output_ring, '\n');
-    ring_write_ch(&output_ring, '\r');
 
+    va_start(va, fmt);
+    ret = vlprintf(line, fmt, va);
     va_end(va);
 
+    line_end(line);
+
     return ret;
 }
 
+/*
+ * Format a log line with its origin as one line, also from an interrupt.
+ * Log lines are not part of a command response, so they are never tagged.
+ */
+void
+serial_log(const char *file, uint16_t lineno, const char *fmt, va_list va)
+{
+    struct serial_line local;
+    struct serial_line *line = line_get(&local);
+    bool tagged = line->tagged;
+
+    line->tagged = false;
+    lprintf(line, "%08x:%s:%d ", (unsigned int)clock_now(), file, lineno);
+    vlprintf(line, fmt, va);
+    line_end(line);
+    line->tagged = tagged;
+}
+
 int
 puts(const char *s)
 {
-    return ring_write(&output_ring, (uint8_t *)s, strlen(s));
+    struct serial_line local;
+    struct serial_line *line = line_get(&local);
+
+    uint16_t len = strlen(s);
+
+    line_tag_prefix(line);
+    line_write(line, (const uint8_t *)s, len);
+    line_put(line);
+
+    return len;
+}
+
+/*
+ * Measure the cost of formatting and committing a typical elog line, into a
+ * scratch ring so the output is not flooded
+ */
+void
+serial_benchmark()
+{
+    static uint8_t scratch_buffer[128];
+    static struct serial_line scratch_line;
+    struct ring scratch;
+    uint32_t start, cycles;
+    uint16_t i;
+
+    ring_init(&scratch, scratch_buffer, sizeof(scratch_buffer));
+    scratch_line.ring = &scratch;
+    scratch_line.len = 0;
+    scratch_line.start = true;
+    scratch_line.tagged = false;
+    dwt_enable_cycle_counter();
+
+    start = dwt_read_cycle_counter();
+    for (i = 0; i < SERIAL_BENCH_LINES; i++) {
+        lprintf(&scratch_line, "%08x:%s:%d ", (unsigned int)i, "keyboard.c", 123);
+        lprintf(&scratch_line, "key %02x %02x %d\n", 0x1e, 0x02, 1);
+        scratch.begin = scratch.end;
+    }
+    cycles = dwt_read_cycle_counter() - start;
+
+    printfnl("elog line: %u cycles", cycles / SERIAL_BENCH_LINES);
 }
@@ -36,10 +36,19 @@
 
 extern bool serial_active;
 void serial_init(void);
-void serial_in(uint8_t *buf, uint16_t len);
+bool serial_in_room(void);
+bool serial_in(uint8_t *buf, uint16_t len);
 void serial_out(void);
+void serial_process(void);
+bool serial_write(uint8_t *buf, uint16_t len);
+void serial_tag_set(int16_t tag);
+int16_t serial_tag_get(void);
+uint32_t serial_output_count(void);
+int32_t serial_output_free(void);
 int printf(const char *fmt, ...);
 int printfnl(const char *fmt, ...);
+void serial_log(const char *file, uint16_t lineno, const char *fmt, va_list va);
 int puts(const char *s);
+void serial_benchmark(void);
 
 #endif /* _SERIAL_H */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * stage
+ *
+ * Gather configuration changes in a copy, and swap them in all at once.
+ * While staging, the keymap, lightmap, rotary and palette setters write to
+ * the copy; the pad keeps running on the old configuration until commit.
+ */
+
+#include <string.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "config.h"
+#include "elog.h"
+#include "light.h"
+#include "rotary.h"
+#include "stage.h"
+
+#define ELOG_MODULE ELOG_STAGE
+
+bool stage_active = false;
+
+static struct {
+    event_t keymap[LAYERS_NUM][ROWS_NUM][COLS_NUM];
+    event_t rotary[LAYERS_NUM][ROTARY_NUM];
+    lightmap_t lightmap;
+    hsv_t palette[PALETTE_NUM];
+} stage;
+
+void
+stage_begin()
+{
+    memcpy(stage.keymap, keymap, sizeof(stage.keymap));
+    memcpy(stage.rotary, rotary, sizeof(stage.rotary));
+    memcpy(&stage.lightmap, &lightmap, sizeof(stage.lightmap));
+    memcpy(stage.palette, palette, sizeof(stage.palette));
+    stage_active = true;
+}
+
+void
+stage_commit()
+{
+    if (! stage_active) {
+        elog_warn("commit without begin");
+        return;
+    }
+
+    cm_disable_interrupts();
+    memcpy(keymap, stage.keymap, sizeof(stage.keymap));
+    memcpy(rotary, stage.rotary, sizeof(stage.rotary));
+    memcpy(&lightmap, &stage.lightmap, sizeof(stage.lightmap));
+    memcpy(palette, stage.palette, sizeof(stage.palette));
+    cm_enable_interrupts();
+
+    stage_active = false;
+    light_apply_state(LIGHT_ALL);
+}
+
+void
+stage_abort()
+{
+    stage_active = false;
+}
+
+/*
+ * Where a setter should write to; positions are checked by the setters
+ */
+event_t *
+stage_keymap(uint8_t l, uint8_t r, uint8_t c)
+{
+    return stage_active ? &stage.keymap[l][r][c] : &keymap[l][r][c];
+}
+
+uint8_t *
+stage_lightmap(uint8_t l, uint8_t r, uint8_t c)
+{
+    return stage_active ? &stage.lightmap.data[l][r][c] : &lightmap.data[l][r][c];
+}
+
+event_t *
+stage_rotary(uint8_t l, uint8_t d)
+{
+    return stage_active ? &stage.rotary[l][d] : &rotary[l][d];
+}
+
+hsv_t *
+stage_palette(uint8_t color)
+{
+    return stage_active ? &stage.palette[color] : &palette[color];
+}
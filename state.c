@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * State
+ *
+ * Snapshot and restore the state that the host normally builds up with
+ * separate commands, so that a host can resync in a single round trip.
+ */
+
+#include <string.h>
+
+#include <libopencm3/stm32/crc.h>
+
+#include "elog.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "layer.h"
+#include "light.h"
+#include "macro.h"
+#include "palette.h"
+#include "rgbease.h"
+#include "rotary.h"
+#include "state.h"
+
+#define ELOG_MODULE ELOG_STATE
+
+static uint32_t
+state_crc_block(const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    uint32_t word, crc = 0;
+
+    /* The tables are a multiple of 4 bytes, but not necessarily aligned */
+    for (; len >= sizeof(word); len -= sizeof(word), p += sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        crc = crc_calculate(word);
+    }
+
+    return crc;
+}
+
+static uint32_t
+state_config_crc()
+{
+    event_t event;
+    uint8_t key, i;
+
+    crc_reset();
+    state_crc_block(keymap, sizeof(event_t) * LAYERS_NUM * ROWS_NUM * COLS_NUM);
+    state_crc_block(rotary, sizeof(event_t) * LAYERS_NUM * ROTARY_NUM);
+    for (key = 0; key < MACRO_MAXKEYS; key++) {
+        for (i = 0; macro_get_event(key, i, &event); i++) {
+            state_crc_block(&event, sizeof(event));
+        }
+        crc_calculate(macros[key].len);
+    }
+    state_crc_block(palette, sizeof(palette));
+
+    return state_crc_block(&lightmap, sizeof(lightmap));
+}
+
+/*
+ * Fill buf, which holds at least STATE_SNAPSHOT_MAX bytes; returns the
+ * snapshot length
+ */
+uint8_t
+state_snapshot(uint8_t *buf)
+{
+    uint8_t len = 0, version_len;
+    uint32_t crc;
+    uint8_t s;
+
+    buf[len++] = STATE_FORMAT;
+    buf[len++] = layer;
+    for (s = 0; s < SCREENS_NUM; s++) {
+        buf[len++] = light_state.desktop[s];
+    }
+    buf[len++] = light_state.max_screen;
+    buf[len++] = light_state.mic_mute;
+    buf[len++] = light_state.mute;
+    buf[len++] = light_state.volume;
+    buf[len++] = light_state.volume >> 8;
+    buf[len++] = nkro_active;
+    buf[len++] = rgbintensity;
+
+    crc = state_config_crc();
+    buf[len++] = crc;
+    buf[len++] = crc >> 8;
+    buf[len++] = crc >> 16;
+    buf[len++] = crc >> 24;
+
+    version_len = strlen(OROCHI_VERSION);
+    if (version_len > STATE_VERSION_MAX) {
+        version_len = STATE_VERSION_MAX;
+    }
+    buf[len++] = version_len;
+    memcpy(&buf[len], OROCHI_VERSION, version_len);
+
+    return len + version_len;
+}
+
+/*
+ * Whether a snapshot only holds values the setters could have produced;
+ * desktops and mute flags take any value, as the D commands do
+ */
+static bool
+state_valid(uint8_t *buf)
+{
+    uint8_t *rest = &buf[2 + SCREENS_NUM];
+
+    return ((buf[1] < LAYERS_NUM) &&
+            (rest[0] <= SCREENS_NUM) &&
+            (rest[5] <= 1));
+}
+
+/*
+ * Restore from the first STATE_RESTORE_SIZE bytes of a snapshot. A
+ * snapshot with a value out of range is rejected as a whole.
+ */
+bool
+state_restore(uint8_t *buf)
+{
+    uint8_t s;
+
+    if (buf[0] != STATE_FORMAT) {
+        elog_error("state format %02x unknown", buf[0]);
+        return false;
+    }
+
+    if (! state_valid(buf)) {
+        elog_error("state out of range");
+        return false;
+    }
+
+    layer_set(buf[1]);
+    buf += 2;
+    for (s = 0; s < SCREENS_NUM; s++) {
+        light_state.desktop[s] = *buf++;
+    }
+    light_state.max_screen = buf[0];
+    light_state.mic_mute = buf[1];
+    light_state.mute = buf[2];
+    light_state.volume = buf[3] | ((uint16_t)buf[4] << 8);
+    keyboard_set_nkro(buf[5]);
+    rgbintensity = buf[6];
+
+    light_apply_state(0);
+
+    return true;
+}
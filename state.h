@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STATE_H
+#define _STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Snapshot of the live state, all numbers little endian:
+ *
+ * | bytes       | description                                   |
+ * |-------------+-----------------------------------------------|
+ * |           1 | STATE_FORMAT                                  |
+ * |           1 | active layer                                  |
+ * | SCREENS_NUM | desktop shown per screen                      |
+ * |           1 | number of screens seen                        |
+ * |           1 | microphone mute                               |
+ * |           1 | sound mute                                    |
+ * |           2 | sound volume                                  |
+ * |           1 | nkro active                                   |
+ * |           1 | rgb intensity                                 |
+ * |           4 | crc32 of the live configuration               |
+ * |           1 | length n of the firmware version              |
+ * |           n | firmware version, as in the usb serial string |
+ *
+ * A restore takes the same bytes up to and including the rgb intensity;
+ * anything after that is ignored.
+ */
+#define STATE_FORMAT          1
+#define STATE_RESTORE_SIZE    (9 + SCREENS_NUM)
+#define STATE_VERSION_MAX     32
+#define STATE_SNAPSHOT_MAX    (STATE_RESTORE_SIZE + 5 + STATE_VERSION_MAX)
+
+uint8_t state_snapshot(uint8_t *buf);
+bool state_restore(uint8_t *buf);
+
+#endif /* _STATE_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Type
+ *
+ * Type text streamed in by the host, as fast as the host polls for reports.
+ * A character is a press and a release report, in every mode; hosts do not
+ * agree on the order of keys that go down in the same report.
+ */
+
+#include <stddef.h>
+
+#include "command.h"
+#include "config.h"
+#include "elog.h"
+#include "frame.h"
+#include "keyboard.h"
+#include "map_ascii.h"
+#include "ring.h"
+#include "type.h"
+#include "usb.h"
+
+#define ELOG_MODULE ELOG_TYPE
+
+static struct ring type_ring;
+static uint8_t type_buffer[TYPE_BUF_SIZE];
+
+static event_t *type_held;
+
+static bool type_framed;
+static uint16_t type_uncredited;
+
+volatile bool type_active = false;
+
+void
+type_init()
+{
+    ring_init(&type_ring, type_buffer, sizeof(type_buffer));
+}
+
+static void
+type_credit()
+{
+    uint16_t credit = RING_FREE(&type_ring);
+    uint8_t payload[2] = { credit, credit >> 8 };
+
+    type_uncredited = 0;
+    frame_send(CMD_TYPE, payload, sizeof(payload));
+}
+
+/*
+ * Queue all of text. In text mode the rest of the line is typed; a frame
+ * carries the text up to its end. Returns false if it does not fit.
+ */
+bool
+type_queue(struct ring *text, bool framed)
+{
+    int32_t len = RING_USED(text);
+    uint8_t c;
+
+    if (framed) {
+        type_framed = true;
+        if (len == 0) {
+            type_credit();
+            return true;
+        }
+    }
+
+    if (len > RING_FREE(&type_ring)) {
+        elog_warn("type queue full");
+        return false;
+    }
+
+    while (ring_read_ch(text, &c) != -1) {
+        if ((! framed) && ((c == '\n') || (c == '\r'))) {
+            break;
+        }
+        ring_write_ch(&type_ring, c);
+    }
+
+    type_active = true;
+
+    return true;
+}
+
+static event_t *
+type_event(uint8_t c)
+{
+    event_t *event = map_ascii_to_event(c);
+
+    if (! event) {
+        elog_warn("cannot type %02x", c);
+    }
+
+    return event;
+}
+
+/*
+ * Press the key of the next character that can be typed
+ */
+static void
+type_press()
+{
+    uint8_t c;
+
+    while ((! type_held) && (ring_read_ch(&type_ring, &c) != -1)) {
+        type_held = type_event(c);
+        type_uncredited++;
+    }
+
+    if (! type_held) {
+        return;
+    }
+
+    if (type_held->key.mod) {
+        keyboard_add_modifier(type_held->key.mod);
+    }
+    keyboard_add_key(type_held->key.code);
+    keyboard_flush();
+}
+
+static void
+type_release()
+{
+    keyboard_del_key(type_held->key.code);
+    if (type_held->key.mod) {
+        keyboard_del_modifier(type_held->key.mod);
+    }
+    keyboard_flush();
+
+    type_held = NULL;
+}
+
+void
+type_process()
+{
+    if (! (usb_ep_keyboard_idle && usb_ep_nkro_idle)) {
+        return;
+    }
+
+    if (type_held) {
+        type_release();
+    } else if (! RING_EMPTY(&type_ring)) {
+        type_press();
+    }
+
+    if ((! type_held) && RING_EMPTY(&type_ring)) {
+        type_active = false;
+    }
+
+    if (type_framed &&
+        ((type_uncredited >= TYPE_CREDIT_STEP) ||
+         ((! type_active) && type_uncredited))) {
+        type_credit();
+    }
+}
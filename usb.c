@@ -33,11 +33,13 @@
  * - boot usb keyboard
  * - boot usb mouse
  * - usb extrakey that can report <system|consumer> control/application events
+ *   and an absolute pointer
  * - nkro usb keyboard
  * - a cdc/acm usb serial port
  */
 
 #include <stdlib.h>
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/gpio.h>
@@ -48,18 +50,24 @@
 #include <libopencm3/usb/hid.h>
 #include <libopencm3/usb/usbd.h>
 
+#include "automouse.h"
 #include "descriptor.h"
 #include "elog.h"
 #include "extrakey.h"
 #include "hid.h"
 #include "keyboard.h"
 #include "mouse.h"
+#include "serial.h"
 #include "usb.h"
 #include "usb_keycode.h"
 
+#define ELOG_MODULE ELOG_USB
+
 static usbd_device *usbd_dev;
 volatile uint32_t usb_ms;
 volatile uint32_t usb_ifs_enumerated;
+volatile usb_stats_t usb_stats;
+static volatile uint8_t usb_serial_rx_paused;
 volatile uint8_t usb_ep_keyboard_idle;
 volatile uint8_t usb_ep_mouse_idle;
 volatile uint8_t usb_ep_nkro_idle;
@@ -195,6 +203,16 @@ const struct usb_interface_descriptor keyboard_iface = {
  * |    2 | y           |
  * |    3 | w           |
  * |    4 | h           |
+ *
+ * Feature report (1 byte):
+ * | bit | description                  |
+ * |-----+------------------------------|
+ * | 0-1 | Wheel resolution multiplier  |
+ * | 2-3 | Pan resolution multiplier    |
+ * | 4-7 | CONSTANT                     |
+ *
+ * A host that understands resolution multipliers sets these to 1, after
+ * which wheel and pan are reported in 1/WHEEL_MULTIPLIER detents.
  */
 const uint8_t mouse_report_descriptor[] = {
     HID_RI_USAGE_PAGE(8, 0x01),                /* Generic Desktop */
@@ -224,20 +242,50 @@ const uint8_t mouse_report_descriptor[] = {
             HID_RI_REPORT_SIZE(8, 0x08),
             HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
 
-            HID_RI_USAGE(8, 0x38),             /* Wheel */
-            HID_RI_LOGICAL_MINIMUM(8, -127),
-            HID_RI_LOGICAL_MAXIMUM(8, 127),
-            HID_RI_REPORT_COUNT(8, 0x01),
-            HID_RI_REPORT_SIZE(8, 0x08),
-            HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
-
-            HID_RI_USAGE_PAGE(8, 0x0C),        /* Consumer */
-            HID_RI_USAGE(16, 0x0238),          /* AC Pan (Horizontal wheel) */
-            HID_RI_LOGICAL_MINIMUM(8, -127),
-            HID_RI_LOGICAL_MAXIMUM(8, 127),
-            HID_RI_REPORT_COUNT(8, 0x01),
-            HID_RI_REPORT_SIZE(8, 0x08),
-            HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
+            HID_RI_COLLECTION(8, 0x02),        /* Logical */
+                HID_RI_USAGE(8, 0x48),         /* Resolution Multiplier */
+                HID_RI_LOGICAL_MINIMUM(8, 0),
+                HID_RI_LOGICAL_MAXIMUM(8, 1),
+                HID_RI_PHYSICAL_MINIMUM(8, 1),
+                HID_RI_PHYSICAL_MAXIMUM(8, WHEEL_MULTIPLIER),
+                HID_RI_REPORT_COUNT(8, 0x01),
+                HID_RI_REPORT_SIZE(8, 0x02),
+                HID_RI_FEATURE(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+
+                HID_RI_USAGE(8, 0x38),         /* Wheel */
+                HID_RI_PHYSICAL_MINIMUM(8, 0),
+                HID_RI_PHYSICAL_MAXIMUM(8, 0),
+                HID_RI_LOGICAL_MINIMUM(8, -127),
+                HID_RI_LOGICAL_MAXIMUM(8, 127),
+                HID_RI_REPORT_COUNT(8, 0x01),
+                HID_RI_REPORT_SIZE(8, 0x08),
+                HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
+            HID_RI_END_COLLECTION(0),
+
+            HID_RI_COLLECTION(8, 0x02),        /* Logical */
+                HID_RI_USAGE(8, 0x48),         /* Resolution Multiplier */
+                HID_RI_LOGICAL_MINIMUM(8, 0),
+                HID_RI_LOGICAL_MAXIMUM(8, 1),
+                HID_RI_PHYSICAL_MINIMUM(8, 1),
+                HID_RI_PHYSICAL_MAXIMUM(8, WHEEL_MULTIPLIER),
+                HID_RI_REPORT_COUNT(8, 0x01),
+                HID_RI_REPORT_SIZE(8, 0x02),
+                HID_RI_FEATURE(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+
+                HID_RI_USAGE_PAGE(8, 0x0C),    /* Consumer */
+                HID_RI_USAGE(16, 0x0238),      /* AC Pan (Horizontal wheel) */
+                HID_RI_PHYSICAL_MINIMUM(8, 0),
+                HID_RI_PHYSICAL_MAXIMUM(8, 0),
+                HID_RI_LOGICAL_MINIMUM(8, -127),
+                HID_RI_LOGICAL_MAXIMUM(8, 127),
+                HID_RI_REPORT_COUNT(8, 0x01),
+                HID_RI_REPORT_SIZE(8, 0x08),
+                HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
+            HID_RI_END_COLLECTION(0),
+
+            HID_RI_REPORT_COUNT(8, 0x01),      /* Multiplier padding */
+            HID_RI_REPORT_SIZE(8, 0x04),
+            HID_RI_FEATURE(8, HID_IOF_CONSTANT),
 
         HID_RI_END_COLLECTION(0),
     HID_RI_END_COLLECTION(0),
@@ -271,7 +319,7 @@ const struct usb_endpoint_descriptor mouse_endpoint = {
                      USB_ENDPOINT_ATTR_NOSYNC |
                      USB_ENDPOINT_ATTR_DATA),
     .wMaxPacketSize = EP_SIZE_MOUSE,
-    .bInterval = 0x0A,
+    .bInterval = MS_MOUSEKEY,
 };
 
 const struct usb_interface_descriptor mouse_iface = {
@@ -292,13 +340,33 @@ const struct usb_interface_descriptor mouse_iface = {
 };
 
 /*
- * Extra key report
+ * Extra key reports
  *
- * Input report (3 bytes):
+ * System control input report (3 bytes):
  * | byte | description   |
  * |------+---------------|
  * |    0 | report id     |
  * |  1-2 | keycode       |
+ *
+ * Consumer control input report (1 + 2 * CONSUMER_USAGES_NUM bytes):
+ * | byte | description   |
+ * |------+---------------|
+ * |    0 | report id     |
+ * |  1-2 | keycode 1     |
+ * |  3-4 | keycode 2     |
+ * |  ... | ...           |
+ *
+ * Absolute pointer input report (6 bytes):
+ * | byte | description   |
+ * |------+---------------|
+ * |    0 | report id     |
+ * |    1 | buttons 1-5   |
+ * |  2-3 | x 0-7fff      |
+ * |  4-5 | y 0-7fff      |
+ *
+ * All reports travel over the same endpoint, the report id tells them
+ * apart. Each report has its own state, so system and consumer keys can be
+ * held at the same time.
  */
 static const uint8_t extrakey_report_descriptor[] = {
     HID_RI_USAGE_PAGE(8, 0x01),                /* Generic Desktop */
@@ -323,9 +391,37 @@ static const uint8_t extrakey_report_descriptor[] = {
         HID_RI_LOGICAL_MINIMUM(16, CONSUMER_POWER),
         HID_RI_LOGICAL_MAXIMUM(16, CONSUMER_AC_SEND),
         HID_RI_REPORT_SIZE(8, 16),
-        HID_RI_REPORT_COUNT(8, 1),
+        HID_RI_REPORT_COUNT(8, CONSUMER_USAGES_NUM),
         HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_ARRAY | HID_IOF_ABSOLUTE),
     HID_RI_END_COLLECTION(0),
+
+    HID_RI_USAGE_PAGE(8, 0x01),                /* Generic Desktop */
+    HID_RI_USAGE(8, 0x02),                     /* Mouse */
+    HID_RI_COLLECTION(8, 0x01),                /* Application */
+        HID_RI_REPORT_ID(8, REPORTID_POINTER),
+        HID_RI_USAGE(8, 0x01),                 /* Pointer */
+        HID_RI_COLLECTION(8, 0x00),            /* Physical */
+            HID_RI_USAGE_PAGE(8, 0x09),        /* Button */
+            HID_RI_USAGE_MINIMUM(8, 0x01),
+            HID_RI_USAGE_MAXIMUM(8, 0x05),
+            HID_RI_LOGICAL_MINIMUM(8, 0x00),
+            HID_RI_LOGICAL_MAXIMUM(8, 0x01),
+            HID_RI_REPORT_SIZE(8, 0x01),
+            HID_RI_REPORT_COUNT(8, 0x05),
+            HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+            HID_RI_REPORT_SIZE(8, 0x03),
+            HID_RI_REPORT_COUNT(8, 0x01),
+            HID_RI_INPUT(8, HID_IOF_CONSTANT),
+            HID_RI_USAGE_PAGE(8, 0x01),        /* Generic Desktop */
+            HID_RI_USAGE(8, 0x30),             /* X */
+            HID_RI_USAGE(8, 0x31),             /* Y */
+            HID_RI_LOGICAL_MINIMUM(8, 0x00),
+            HID_RI_LOGICAL_MAXIMUM(16, POINTER_MAX),
+            HID_RI_REPORT_SIZE(8, 0x10),
+            HID_RI_REPORT_COUNT(8, 0x02),
+            HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+        HID_RI_END_COLLECTION(0),
+    HID_RI_END_COLLECTION(0),
 };
 
 static const struct {
@@ -385,13 +481,15 @@ const struct usb_interface_descriptor extrakey_iface = {
  * |    0 | Modifier keys |
  * |    1+| Key bitfield  |
  *
- * The key bitfield starts at keycode for 'a' and continues EP_SIZE_NKRO
- * bytes. Each bitfield byte holds the status for 8 additional keys.
+ * The key bitfield starts at usage 0 and continues EP_SIZE_NKRO - 1
+ * bytes. Each bitfield byte holds the status for 8 additional keys. With
+ * 29 bytes this covers every usage upto the modifiers, which are reported
+ * in the modifier byte; so every key in the keyboard page can be pressed
+ * at the same time.
  *
  * | EP_SIZE_NKRO | total keys |
  * |--------------+------------|
- * |           29 |        224 |
- * |           19 |        144 |
+ * |           29 |    224 + 8 |
  *
  * Output report (1 byte):
  * | bit | description   |
@@ -428,8 +526,8 @@ const uint8_t nkro_report_descriptor[] =
         HID_RI_OUTPUT(8, HID_IOF_CONSTANT),    /* Led padding */
 
         HID_RI_USAGE_PAGE(8, 0x07),            /* Keyboard */
-        HID_RI_USAGE_MINIMUM(8, KEY_A),
-        HID_RI_USAGE_MAXIMUM(8, ((EP_SIZE_NKRO -1 ) * 8) + KEY_A - 1),
+        HID_RI_USAGE_MINIMUM(8, 0x00),
+        HID_RI_USAGE_MAXIMUM(8, ((EP_SIZE_NKRO - 1) * 8) - 1),
         HID_RI_LOGICAL_MINIMUM(8, 0x00),
         HID_RI_LOGICAL_MAXIMUM(8, 0x01),
         HID_RI_REPORT_COUNT(8, (EP_SIZE_NKRO - 1) * 8),
@@ -708,14 +806,28 @@ usb_control_request(usbd_device *dev, struct usb_setup_data *req, uint8_t **buf,
             break;
 
         case IF_MOUSE:
-            *buf = (uint8_t *) mouse_report();
-            *len = sizeof(report_mouse_t);
+            if ((req->wValue >> 8) == USBHID_REPORT_TYPE_FEATURE) {
+                *buf = mouse_get_resolution();
+                *len = 1;
+            } else {
+                *buf = (uint8_t *) mouse_report();
+                *len = sizeof(report_mouse_t);
+            }
             return USBD_REQ_HANDLED;
             break;
 
         case IF_EXTRAKEY:
-            *buf = (uint8_t *) extrakey_report();
-            *len = sizeof(report_extrakey_t);
+            /* Low byte of wValue holds the requested report id */
+            if ((req->wValue & 0xff) == REPORTID_SYSTEM) {
+                *buf = (uint8_t *) extrakey_system_report();
+                *len = sizeof(report_system_t);
+            } else if ((req->wValue & 0xff) == REPORTID_POINTER) {
+                *buf = (uint8_t *) automouse_pointer_report();
+                *len = sizeof(report_pointer_t);
+            } else {
+                *buf = (uint8_t *) extrakey_consumer_report();
+                *len = sizeof(report_consumer_t);
+            }
             return USBD_REQ_HANDLED;
             break;
 
@@ -733,6 +845,13 @@ usb_control_request(usbd_device *dev, struct usb_setup_data *req, uint8_t **buf,
                 keyboard_set_leds(**buf);
             return USBD_REQ_HANDLED;
             break;
+
+        case IF_MOUSE:
+            if (((req->wValue >> 8) == USBHID_REPORT_TYPE_FEATURE) &&
+                len && *len && buf && *buf)
+                mouse_set_resolution(**buf);
+            return USBD_REQ_HANDLED;
+            break;
         }
     } else if (req->bRequest == USBHID_REQ_GET_IDLE) {
         switch (req->wIndex) {
@@ -821,13 +940,23 @@ usb_write_packet(usbd_device *dev, uint8_t addr, const void* buf, uint16_t len)
 {
     int tries = 0;
     uint16_t wlen;
+    volatile usb_ep_stats_t *stats = &usb_stats.ep[addr & 0x7f];
 
-    for (wlen = usbd_ep_write_packet(dev, addr, buf, len);
-         (wlen == 0) && (tries < SEND_RETRIES);
-         tries++);
+    stats->submitted++;
 
+    wlen = usbd_ep_write_packet(dev, addr, buf, len);
     if (wlen == 0) {
-        elog("could not send packet to %x", addr);
+        usb_stats.retry_loops++;
+        while ((wlen == 0) && (tries < SEND_RETRIES)) {
+            wlen = usbd_ep_write_packet(dev, addr, buf, len);
+            tries++;
+        }
+        stats->retried += tries;
+    }
+
+    if (wlen == 0) {
+        stats->dropped++;
+        elog_error("could not send packet to %x", addr);
     }
     return wlen;
 }
@@ -847,10 +976,24 @@ usb_update_mouse(report_mouse_t *report)
 }
 
 void
-usb_update_extrakey(report_extrakey_t *report)
+usb_update_system(report_system_t *report)
 {
     usb_ep_extrakey_idle = 0;
-    usb_write_packet(usbd_dev, EP_EXTRAKEY, &report->raw, EP_SIZE_EXTRAKEY);
+    usb_write_packet(usbd_dev, EP_EXTRAKEY, &report->raw, EP_SIZE_SYSTEM);
+}
+
+void
+usb_update_consumer(report_consumer_t *report)
+{
+    usb_ep_extrakey_idle = 0;
+    usb_write_packet(usbd_dev, EP_EXTRAKEY, &report->raw, EP_SIZE_CONSUMER);
+}
+
+void
+usb_update_pointer(report_pointer_t *report)
+{
+    usb_ep_extrakey_idle = 0;
+    usb_write_packet(usbd_dev, EP_EXTRAKEY, &report->raw, EP_SIZE_POINTER);
 }
 
 void
@@ -865,6 +1008,9 @@ usb_set_config(usbd_device *dev, uint16_t wValue)
 {
     (void)wValue;
 
+    /* Hosts that want high resolution scrolling ask for it again */
+    mouse_set_resolution(0);
+
     usbd_ep_setup(dev,
                   USB_ENDPOINT_ADDR_IN(EP_KEYBOARD),
                   USB_ENDPOINT_ATTR_INTERRUPT,
@@ -985,6 +1131,8 @@ usb_endpoint_idle(usbd_device *dev, uint8_t ep)
 {
     (void)dev;
 
+    usb_stats.ep[ep & 0x7f].completed++;
+
     switch (ep) {
         case EP_KEYBOARD:
             usb_ep_keyboard_idle = 1;
@@ -1021,19 +1169,96 @@ cdcacm_data_rx_cb(usbd_device *dev, uint8_t ep)
     /* Handle trouble like remote going away */
     if (istr & USB_ISTR_ERR) {
         USB_CLR_ISTR_ERR();
+        usb_stats.rx_errors++;
         return;
     }
 
     len = usbd_ep_read_packet(dev,
                               USB_ENDPOINT_ADDR_OUT(EP_SERIALDATAOUT),
                               serialbuf, EP_SIZE_SERIALDATAOUT);
+    usb_stats.ep[EP_SERIALDATAOUT].completed++;
 
-    serial_in((uint8_t *)serialbuf, len);
+    if (serial_in((uint8_t *)serialbuf, len)) {
+        /* Input is full; nak the host until the main loop catches up */
+        usb_serial_rx_paused = 1;
+        usbd_ep_nak_set(dev, EP_SERIALDATAOUT, 1);
+    }
+}
+
+/*
+ * Let the host send again once the input has room for a packet. Checked
+ * with interrupts off, so the rx interrupt cannot fill the input between
+ * the check and the un-nak.
+ */
+void
+cdcacm_data_rx_resume()
+{
+    cm_disable_interrupts();
+    if (usb_serial_rx_paused && serial_in_room()) {
+        usb_serial_rx_paused = 0;
+        usbd_ep_nak_set(usbd_dev, EP_SERIALDATAOUT, 0);
+    }
+    cm_enable_interrupts();
 }
 
 void
 cdcacm_data_wx(uint8_t *buf, uint16_t len)
 {
     usb_ep_serial_idle = 0;
-    usbd_ep_write_packet(usbd_dev, EP_SERIALDATAIN, buf, len);
+    usb_stats.ep[EP_SERIALDATAIN].submitted++;
+    if (! usbd_ep_write_packet(usbd_dev, EP_SERIALDATAIN, buf, len)) {
+        usb_stats.ep[EP_SERIALDATAIN].dropped++;
+    }
+}
+
+/*
+ * Dump generator; a header line, a line per endpoint and the totals
+ */
+bool
+usb_dump(uint16_t index)
+{
+    static const struct {
+        uint8_t ep;
+        const char *name;
+    } eps[] = {
+        { EP_KEYBOARD,      "keyboard" },
+        { EP_MOUSE,         "mouse" },
+        { EP_EXTRAKEY,      "extrakey" },
+        { EP_NKRO,          "nkro" },
+        { EP_SERIALDATAIN,  "serial in" },
+        { EP_SERIALDATAOUT, "serial out" },
+    };
+    static const uint16_t eps_num = sizeof(eps) / sizeof(eps[0]);
+    volatile usb_ep_stats_t *stats;
+
+    if (index == 0) {
+        printfnl("ep submitted completed retried dropped");
+    } else if (index <= eps_num) {
+        stats = &usb_stats.ep[eps[index - 1].ep];
+        printfnl("%02x %u %u %u %u %s", eps[index - 1].ep,
+                 stats->submitted, stats->completed,
+                 stats->retried, stats->dropped, eps[index - 1].name);
+    } else {
+        switch (index - eps_num) {
+            case 1:
+                printfnl("retry loops %u", usb_stats.retry_loops);
+                break;
+            case 2:
+                printfnl("rx errors %u", usb_stats.rx_errors);
+                break;
+            case 3:
+                printfnl("resets %u", usb_stats.resets);
+                break;
+            case 4:
+                printfnl("suspends %u", usb_stats.suspends);
+                break;
+            case 5:
+                printfnl("resumes %u", usb_stats.resumes);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
 }
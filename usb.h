@@ -36,7 +36,8 @@
  * - 4 interfaces that carry hid endpoints
  *   - 1 endpoint boot keyboard
  *   - 1 endpoint boot mouse
- *   - 1 endpoint extra keys (system control/application keys)
+ *   - 1 endpoint extra keys (system control/application keys, absolute
+ *     pointer)
  *   - 1 endpoint nkro keyboard
  * - 3 interfaces for cdc acm definition
  *   - 1 endpoint for communication interrupts
@@ -66,7 +67,10 @@
 
 #define EP_SIZE_KEYBOARD                        8
 #define EP_SIZE_MOUSE                           5
-#define EP_SIZE_EXTRAKEY                        3
+#define EP_SIZE_SYSTEM                          3
+#define EP_SIZE_CONSUMER                        (1 + (CONSUMER_USAGES_NUM * 2))
+#define EP_SIZE_POINTER                         6
+#define EP_SIZE_EXTRAKEY                        EP_SIZE_CONSUMER
 #define EP_SIZE_NKRO                            29
 
 #define EP_SIZE_SERIALCOMM                      16
@@ -85,6 +89,24 @@
 
 #define REPORTID_SYSTEM                         1
 #define REPORTID_CONSUMER                       2
+#define REPORTID_POINTER                        3
+
+/*
+ * Absolute pointer coordinates run from 0 to POINTER_MAX across the whole
+ * screen, whatever its resolution
+ */
+#define POINTER_MAX                             0x7fff
+
+/*
+ * Number of consumer usages that can be reported as active at the same time
+ */
+#define CONSUMER_USAGES_NUM                     4
+
+/*
+ * Wheel resolution multiplier; a host that enables high resolution
+ * scrolling receives wheel and pan in 1/WHEEL_MULTIPLIER detents
+ */
+#define WHEEL_MULTIPLIER                        8
 
 #define CDC_CONTROL_LINE_STATE_DTR              1
 #define CDC_CONTROL_LINE_STATE_RTS              2
@@ -118,13 +140,30 @@ typedef union {
 } __attribute__ ((packed)) report_mouse_t;
 
 typedef union {
-    uint8_t raw[EP_SIZE_EXTRAKEY];
+    uint8_t raw[EP_SIZE_SYSTEM];
     struct {
         uint8_t id;
-        uint8_t codel;
-        uint8_t codeh;
-    };
-} __attribute__ ((packed)) report_extrakey_t;
+        uint16_t code;
+    } __attribute__ ((packed));
+} __attribute__ ((packed)) report_system_t;
+
+typedef union {
+    uint8_t raw[EP_SIZE_CONSUMER];
+    struct {
+        uint8_t id;
+        uint16_t codes[CONSUMER_USAGES_NUM];
+    } __attribute__ ((packed));
+} __attribute__ ((packed)) report_consumer_t;
+
+typedef union {
+    uint8_t raw[EP_SIZE_POINTER];
+    struct {
+        uint8_t id;
+        uint8_t buttons;
+        uint16_t x;
+        uint16_t y;
+    } __attribute__ ((packed));
+} __attribute__ ((packed)) report_pointer_t;
 
 typedef union {
     uint8_t raw[EP_SIZE_NKRO];
@@ -134,7 +173,30 @@ typedef union {
     };
 } __attribute__ ((packed)) report_nkro_t;
 
+/*
+ * Traffic counters, per endpoint number. Submitted counts packets handed to
+ * the usb peripheral, completed those the host actually picked up. Retried
+ * counts extra write attempts on a busy endpoint, dropped the packets that
+ * never made it into the peripheral.
+ */
+typedef struct {
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t retried;
+    uint32_t dropped;
+} usb_ep_stats_t;
+
+typedef struct {
+    usb_ep_stats_t ep[EP_SERIALDATAOUT + 1];
+    uint32_t retry_loops;
+    uint32_t rx_errors;
+    uint32_t resets;
+    uint32_t suspends;
+    uint32_t resumes;
+} usb_stats_t;
+
 extern const char *usb_strings[];
+extern volatile usb_stats_t usb_stats;
 
 extern volatile uint32_t usb_ms;
 extern volatile uint32_t usb_ifs_enumerated;
@@ -155,12 +217,16 @@ void usb_suspend(void);
 
 void usb_update_keyboard(report_keyboard_t *);
 void usb_update_mouse(report_mouse_t *);
-void usb_update_extrakey(report_extrakey_t *);
+void usb_update_system(report_system_t *);
+void usb_update_consumer(report_consumer_t *);
+void usb_update_pointer(report_pointer_t *);
 void usb_update_nkro(report_nkro_t *);
 
 void usb_endpoint_idle(usbd_device *dev, uint8_t ep);
+bool usb_dump(uint16_t index);
 
 void cdcacm_data_rx_cb(usbd_device *dev, uint8_t ep);
+void cdcacm_data_rx_resume(void);
 void cdcacm_data_wx(uint8_t *buf, uint16_t len);
 
 #endif /* _USB_H */
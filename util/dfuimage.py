@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+#
+# Turn a firmware binary into an image the dfu bootloader accepts: pad it
+# to the size of the firmware region and store the stm32 crc of the padded
+# image in its last word.
+#
+# usage: dfuimage.py <firmware.bin> <firmware.dfu>
+
+import struct
+import sys
+
+# BOOT_APP_END - BOOT_APP_BASE in boot.h
+REGION_SIZE = 0x0800F000 - 0x08002000
+
+
+def stm32_crc(data):
+    """CRC-32 as calculated by the stm32 crc unit: per little endian word,
+    msb first, no reflection, no final xor."""
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack('<I', data):
+        crc ^= word
+        for _ in range(32):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} <firmware.bin> <firmware.dfu>')
+
+    with open(sys.argv[1], 'rb') as f:
+        image = f.read()
+
+    if len(image) > REGION_SIZE - 4:
+        sys.exit(f'image is {len(image)} bytes, region holds {REGION_SIZE - 4}')
+
+    image += b'\xff' * (REGION_SIZE - 4 - len(image))
+    image += struct.pack('<I', stm32_crc(image))
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(image)
+
+
+if __name__ == '__main__':
+    main()
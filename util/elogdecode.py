@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+#
+# Format binary log records of the keyboard on the host. Text output and
+# command replies pass through unchanged; log frames are looked up in the
+# elf file of the running firmware and printed as the text logger would,
+# with a microsecond timestamp.
+#
+# Switch the keyboard to binary logging with the 'Eb' command.
+#
+# usage: elogdecode.py <firmware.elf> [<capture file or raw tty>]
+
+import struct
+import sys
+
+FRAME_STX = 0x02
+FRAME_ACK = 0x06
+FRAME_NAK = 0x15
+CMD_LOG = ord('E')
+
+# struct elog_site in elog.h: file, fmt, line, nargs, level, module
+SITE_FORMAT = '<IIHBBB'
+LEVELS = '-EWID'
+RECORD_HEADER = '<BII'
+
+
+class Elf:
+    """Loadable segments of a 32 bit little endian elf file"""
+
+    def __init__(self, file_name):
+        with open(file_name, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1 or self.data[5] != 1:
+            sys.exit(f'{file_name}: not a 32 bit little endian elf file')
+
+        (phoff,) = struct.unpack_from('<I', self.data, 28)
+        phentsize, phnum = struct.unpack_from('<HH', self.data, 42)
+
+        self.segments = []
+        for i in range(phnum):
+            (p_type, p_offset, p_vaddr, _, p_filesz) = struct.unpack_from(
+                '<IIIII', self.data, phoff + i * phentsize)
+            if p_type == 1:
+                self.segments.append((p_vaddr, p_offset, p_filesz))
+
+    def read(self, address, size):
+        for (vaddr, offset, filesz) in self.segments:
+            if vaddr <= address and address + size <= vaddr + filesz:
+                start = offset + address - vaddr
+                return self.data[start:start + size]
+        return None
+
+    def string(self, address):
+        for (vaddr, offset, filesz) in self.segments:
+            if vaddr <= address < vaddr + filesz:
+                start = offset + address - vaddr
+                end = self.data.index(b'\0', start, offset + filesz)
+                return self.data[start:end].decode('ascii', 'replace')
+        return None
+
+
+def frame_crc(data):
+    crc = 0xFFFF
+    for c in data:
+        crc ^= c << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def format_line(elf, fmt, args):
+    """The printf subset of serial.c: %u %d %x %X %c %s, with zero padding"""
+    out = []
+    args = iter(args)
+    i = 0
+    while i < len(fmt):
+        ch = fmt[i]
+        i += 1
+        if ch != '%':
+            out.append(ch)
+            continue
+
+        pad = 0
+        ch = fmt[i:i + 1]
+        i += 1
+        if ch == '0':
+            if fmt[i:i + 1].isdigit():
+                pad = int(fmt[i])
+            ch = fmt[i + 1:i + 2]
+            i += 2
+
+        if ch in 'udxXcs' and ch != '':
+            value = next(args, 0)
+            if ch == 'u':
+                text = str(value)
+            elif ch == 'd':
+                text = str(value - (1 << 32) if value & 0x80000000 else value)
+            elif ch == 'x':
+                text = f'{value:x}'
+            elif ch == 'X':
+                text = f'{value:X}'
+            elif ch == 'c':
+                text = chr(value & 0xFF)
+            else:
+                text = elf.string(value)
+                if text is None:
+                    text = f'<{value:08x}>'
+            if ch != 's' and ch != 'c':
+                negative = text.startswith('-')
+                text = text.lstrip('-').rjust(pad, '0')
+                if negative:
+                    text = '-' + text
+            out.append(text)
+        else:
+            out.append(ch)
+    return ''.join(out)
+
+
+def decode_records(elf, payload, out):
+    (dropped,) = struct.unpack_from('<H', payload, 0)
+    if dropped:
+        out.write(f'*** {dropped} records dropped\n')
+
+    pos = 2
+    while pos + struct.calcsize(RECORD_HEADER) <= len(payload):
+        nargs, site_address, us = struct.unpack_from(RECORD_HEADER, payload, pos)
+        pos += struct.calcsize(RECORD_HEADER)
+        args = struct.unpack_from(f'<{nargs}I', payload, pos)
+        pos += 4 * nargs
+
+        site = elf.read(site_address, struct.calcsize(SITE_FORMAT))
+        if site is None:
+            out.write(f'{us:10d}:? unknown site {site_address:08x} {args}\n')
+            continue
+
+        file_address, fmt_address, line, _, level, _ = struct.unpack(SITE_FORMAT, site)
+        fmt = elf.string(fmt_address) or '?'
+        out.write(f'{us:10d}:{LEVELS[level]}:{elf.string(file_address)}:{line} '
+                  f'{format_line(elf, fmt, args)}\n')
+
+
+def decode(elf, stream, out):
+    pending = b''
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, 'read1') else stream.read(4096)
+        if not chunk:
+            break
+        pending += chunk
+
+        while pending:
+            c = pending[0]
+            if c == FRAME_STX:
+                if len(pending) < 4:
+                    break
+                (length,) = struct.unpack_from('<H', pending, 1)
+                if len(pending) < length + 6:
+                    break
+                body = pending[1:length + 4]
+                (crc,) = struct.unpack_from('<H', pending, length + 4)
+                if crc != frame_crc(body):
+                    # Not a frame after all; show the byte and resync
+                    out.write('\\x02')
+                    pending = pending[1:]
+                    continue
+                if body[2] == CMD_LOG:
+                    decode_records(elf, body[3:], out)
+                pending = pending[length + 6:]
+            elif c == FRAME_ACK:
+                if len(pending) < 2:
+                    break
+                pending = pending[2:]
+            elif c == FRAME_NAK:
+                if len(pending) < 3:
+                    break
+                out.write(f'*** nak {chr(pending[1])} reason {pending[2]}\n')
+                pending = pending[3:]
+            else:
+                end = len(pending)
+                for control in (FRAME_STX, FRAME_ACK, FRAME_NAK):
+                    i = pending.find(bytes([control]))
+                    if i != -1:
+                        end = min(end, i)
+                out.write(pending[:end].decode('ascii', 'replace').replace('\r', ''))
+                pending = pending[end:]
+        out.flush()
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(f'usage: {sys.argv[0]} <firmware.elf> [<capture file or raw tty>]')
+
+    elf = Elf(sys.argv[1])
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], 'rb', buffering=0) as stream:
+            decode(elf, stream, sys.stdout)
+    else:
+        decode(elf, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * bench
+ *
+ * Throughput of the serial command path: a mix of configuration commands
+ * is sent as text lines and as frames, and the time and cycles spent are
+ * reported per command and per byte. Cycles are those of the host's cycle
+ * counter, so compare runs on the same machine only.
+ *
+ * usage: bench [<rounds>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libopencm3/cm3/dwt.h>
+
+#include "frame.h"
+#include "host.h"
+
+#define BENCH_ROUNDS        2000
+#define BENCH_BLOCK         4096
+
+/*
+ * Every command as a text line, and as the payload of a frame in hex
+ */
+struct bench_command {
+    const char *text;
+    uint8_t opcode;
+    const char *payload;
+};
+
+static const struct bench_command bench_commands[] = {
+    { "K01020301000400",  'K', "01020301000400" },
+    { "K00000001001e00",  'K', "00000001001e00" },
+    { "G000102V",         'G', "00010256" },
+    { "P0300f0ffff",      'P', "0300f0ffff" },
+    { "R010001000080",    'R', "010001000080" },
+    { "I80",              'I', "80" },
+    { "DV0040",           'D', "560040" },
+    { "DD0102",           'D', "440102" },
+    { "@2aK02040401000500", 'K', "02040401000500" },
+    { "Wk0005"
+      "0100040001000500010006000100070001000800",
+      'W', "6b0005"
+      "0100040001000500010006000100070001000800" },
+    { "Wp0004"
+      "0000ffff0040ffff0080ffff00c0ffff",
+      'W', "700004"
+      "0000ffff0040ffff0080ffff00c0ffff" },
+};
+
+#define BENCH_COMMANDS_NUM (sizeof(bench_commands) / sizeof(bench_commands[0]))
+
+static uint8_t
+bench_hex(char c)
+{
+    return (c <= '9') ? (c - '0') : (10 + (c - 'a'));
+}
+
+static uint16_t
+bench_crc(uint16_t crc, uint8_t c)
+{
+    uint8_t i;
+
+    crc ^= (uint16_t)c << 8;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+static size_t
+bench_text(uint8_t *buf, const struct bench_command *command)
+{
+    size_t len = strlen(command->text);
+
+    memcpy(buf, command->text, len);
+    buf[len++] = '\n';
+
+    return len;
+}
+
+static size_t
+bench_frame(uint8_t *buf, const struct bench_command *command)
+{
+    uint16_t len = strlen(command->payload) / 2;
+    uint16_t crc = 0xffff;
+    uint16_t i;
+
+    buf[0] = FRAME_STX;
+    buf[1] = len;
+    buf[2] = len >> 8;
+    buf[3] = command->opcode;
+    for (i = 0; i < len; i++) {
+        buf[4 + i] = (bench_hex(command->payload[2 * i]) << 4) |
+            bench_hex(command->payload[2 * i + 1]);
+    }
+    for (i = 1; i < len + 4; i++) {
+        crc = bench_crc(crc, buf[i]);
+    }
+    buf[len + 4] = crc;
+    buf[len + 5] = crc >> 8;
+
+    return len + 6;
+}
+
+static double
+bench_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_run(const char *name, size_t (*encode)(uint8_t *, const struct bench_command *),
+          unsigned long rounds)
+{
+    static uint8_t stream[BENCH_COMMANDS_NUM * 128];
+    size_t len = 0;
+    size_t i, n;
+    unsigned long round;
+    uint64_t cycles = 0;
+    uint64_t bytes = 0;
+    uint32_t start;
+    double seconds;
+
+    for (i = 0; i < BENCH_COMMANDS_NUM; i++) {
+        len += encode(&stream[len], &bench_commands[i]);
+    }
+
+    host_reset();
+    dwt_enable_cycle_counter();
+    seconds = bench_seconds();
+
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < len; i += n) {
+            n = ((len - i) > BENCH_BLOCK) ? BENCH_BLOCK : (len - i);
+            start = dwt_read_cycle_counter();
+            host_input(&stream[i], n);
+            cycles += (uint32_t)(dwt_read_cycle_counter() - start);
+        }
+        bytes += len;
+    }
+    start = dwt_read_cycle_counter();
+    host_drain();
+    cycles += (uint32_t)(dwt_read_cycle_counter() - start);
+
+    seconds = bench_seconds() - seconds;
+
+    fprintf(stdout, "%-5s %8lu commands %9llu bytes %10.0f commands/s %7.1f cycles/byte\n",
+            name, rounds * BENCH_COMMANDS_NUM, (unsigned long long)bytes,
+            (rounds * BENCH_COMMANDS_NUM) / seconds, (double)cycles / bytes);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long rounds = BENCH_ROUNDS;
+
+    if (argc > 1) {
+        rounds = strtoul(argv[1], NULL, 0);
+    }
+
+    host_init();
+
+    bench_run("text", bench_text, rounds);
+    bench_run("frame", bench_frame, rounds);
+
+    return 0;
+}
@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * host
+ *
+ * Everything the serial command path needs to run on the host. The parser,
+ * rings, frames, dumps and the tables the commands change are the firmware
+ * sources; what drives hardware is replaced here by a stub that does as
+ * little as the callers need.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/stm32/crc.h>
+
+#include "automouse.h"
+#include "clock.h"
+#include "config.h"
+#include "dump.h"
+#include "elog.h"
+#include "flash.h"
+#include "frame.h"
+#include "host.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "led.h"
+#include "light.h"
+#include "macro.h"
+#include "mouse.h"
+#include "mousekey.h"
+#include "rgbease.h"
+#include "rgbpixel.h"
+#include "rotary.h"
+#include "serial.h"
+#include "stage.h"
+#include "type.h"
+#include "usb.h"
+
+bool host_echo = false;
+uint64_t host_output;
+
+uint32_t host_scb_icsr;
+
+static uint32_t host_ms;
+static uint32_t host_crc;
+static bool host_written;
+static bool host_held;
+
+/*
+ * Clock; one tick per step of the main loop
+ */
+uint32_t
+clock_now()
+{
+    return host_ms;
+}
+
+uint32_t
+clock_now_us()
+{
+    return host_ms * 1000;
+}
+
+uint32_t
+timer_set(uint32_t delay)
+{
+    return host_ms + delay;
+}
+
+bool
+timer_passed(uint32_t timer)
+{
+    return (timer < host_ms);
+}
+
+/*
+ * Crc unit; crc32 over words, msb first, as the stm32 computes it
+ */
+void
+crc_reset()
+{
+    host_crc = 0xffffffff;
+}
+
+uint32_t
+crc_calculate(uint32_t data)
+{
+    uint8_t i;
+
+    host_crc ^= data;
+    for (i = 0; i < 32; i++) {
+        host_crc = (host_crc & 0x80000000) ?
+            ((host_crc << 1) ^ 0x04c11db7) : (host_crc << 1);
+    }
+    return host_crc;
+}
+
+/*
+ * Flash and boot; configuration is never stored
+ */
+uint32_t
+flash_clear_config(bool framed)
+{
+    (void)framed;
+    return 0;
+}
+
+uint32_t
+flash_read_config()
+{
+    return 0;
+}
+
+uint32_t
+flash_write_config(bool framed)
+{
+    (void)framed;
+    return 0;
+}
+
+uint32_t
+flash_export_start(bool framed)
+{
+    (void)framed;
+    return 0;
+}
+
+bool
+flash_export(uint16_t index)
+{
+    (void)index;
+    return false;
+}
+
+uint32_t
+flash_import_put(uint16_t offset, const uint8_t *data, uint16_t len, bool framed)
+{
+    (void)offset;
+    (void)data;
+    (void)len;
+    (void)framed;
+    return 0;
+}
+
+bool
+flash_import_busy()
+{
+    return false;
+}
+
+void
+boot_dfu()
+{
+}
+
+/*
+ * Leds
+ */
+rgbpixel_t frame[RGB_ALL_NUM];
+
+void
+rgbpixel_render()
+{
+}
+
+void
+rgbpixel_set(uint8_t n, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (n < RGB_ALL_NUM) {
+        frame[n].g = g;
+        frame[n].r = r;
+        frame[n].b = b;
+    }
+}
+
+void
+led_clear(uint8_t leds)
+{
+    (void)leds;
+}
+
+void
+led_state(uint8_t leds)
+{
+    (void)leds;
+}
+
+/*
+ * Rotary; the table without the encoder
+ */
+event_t rotary[LAYERS_NUM][ROTARY_NUM];
+
+void
+rotary_set(uint8_t l, uint8_t d, event_t *event)
+{
+    if ((l < LAYERS_NUM) && (d < ROTARY_NUM)) {
+        memcpy(stage_rotary(l, d), event, sizeof(event_t));
+    }
+}
+
+bool
+rotary_dump(uint16_t index)
+{
+    if (index >= (LAYERS_NUM * ROTARY_NUM)) {
+        return false;
+    }
+
+    printfnl("rotary %d %d", index / ROTARY_NUM, index % ROTARY_NUM);
+    return true;
+}
+
+/*
+ * Usb; every endpoint is always ready, and serial output is counted and
+ * optionally echoed
+ */
+const char *usb_strings[STRI_MAX + 1] = {
+    "",
+    "host",
+    "5x5x2",
+    "0",
+    "keyboard",
+    "mouse",
+    "extrakey",
+    "nkro",
+    "command",
+};
+
+volatile usb_stats_t usb_stats;
+volatile uint32_t usb_ifs_enumerated = ((1 << IF_KEYBOARD) |
+                                        (1 << IF_MOUSE) |
+                                        (1 << IF_EXTRAKEY) |
+                                        (1 << IF_NKRO) |
+                                        (1 << IF_SERIALCOMM));
+volatile uint8_t usb_ep_keyboard_idle = 1;
+volatile uint8_t usb_ep_mouse_idle = 1;
+volatile uint8_t usb_ep_nkro_idle = 1;
+volatile uint8_t usb_ep_extrakey_idle = 1;
+volatile uint8_t usb_ep_serial_idle = 1;
+
+void
+usb_update_keyboard(report_keyboard_t *report)
+{
+    (void)report;
+}
+
+void
+usb_update_mouse(report_mouse_t *report)
+{
+    (void)report;
+}
+
+void
+usb_update_system(report_system_t *report)
+{
+    (void)report;
+}
+
+void
+usb_update_consumer(report_consumer_t *report)
+{
+    (void)report;
+}
+
+void
+usb_update_pointer(report_pointer_t *report)
+{
+    (void)report;
+}
+
+void
+usb_update_nkro(report_nkro_t *report)
+{
+    (void)report;
+}
+
+bool
+usb_dump(uint16_t index)
+{
+    if (index > EP_SERIALDATAOUT) {
+        return false;
+    }
+
+    printfnl("ep %d %u %u %u %u", index,
+             usb_stats.ep[index].submitted, usb_stats.ep[index].completed,
+             usb_stats.ep[index].retried, usb_stats.ep[index].dropped);
+    return true;
+}
+
+void
+cdcacm_data_rx_resume()
+{
+    if (serial_in_room()) {
+        host_held = false;
+    }
+}
+
+void
+cdcacm_data_wx(uint8_t *buf, uint16_t len)
+{
+    if (len > EP_SIZE_SERIALDATAIN) {
+        fprintf(stderr, "serial packet of %d bytes\n", len);
+        abort();
+    }
+
+    if (host_echo) {
+        fwrite(buf, 1, len, stdout);
+    }
+    host_output += len;
+    host_written = true;
+}
+
+/*
+ * Harness
+ */
+void
+host_init()
+{
+    crc_reset();
+    serial_init();
+    elog_init();
+    light_init();
+    macro_init();
+    type_init();
+    rgbease_init();
+
+    serial_active = true;
+    keyboard_active = true;
+}
+
+/*
+ * Forget whatever a previous input left behind in the serial path
+ */
+void
+host_reset()
+{
+    serial_init();
+    type_init();
+    stage_abort();
+    elog_binary = false;
+    elog_level_set(ELOG_MODULE_ALL, ELOG_INFO);
+
+    serial_active = true;
+}
+
+/*
+ * One pass of the main loop, minus the key matrix and the rotary encoder
+ */
+void
+host_step()
+{
+    host_ms++;
+    host_written = false;
+
+    rgbease_process();
+
+    serial_process();
+    elog_process();
+    serial_out();
+
+    keyboard_process();
+    mouse_process();
+    mousekey_process();
+    automouse_pointer_process();
+
+    if (automouse_active) {
+        automouse_repeat();
+    }
+
+    if (macro_active) {
+        macro_run();
+    }
+
+    if (type_active) {
+        type_process();
+    }
+}
+
+/*
+ * Hand input over in usb packets, and step the main loop whenever the
+ * serial port asks the host to hold off
+ */
+void
+host_input(const uint8_t *data, size_t len)
+{
+    uint16_t n;
+    uint32_t steps = 0;
+
+    while (len) {
+        n = (len > EP_SIZE_SERIALDATAOUT) ? EP_SIZE_SERIALDATAOUT : len;
+
+        host_held = serial_in((uint8_t *)data, n);
+        while (host_held) {
+            host_step();
+            if (++steps > HOST_DRAIN_MAX) {
+                fprintf(stderr, "input held off for %d steps\n", steps);
+                abort();
+            }
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Step until everything queued has been executed and sent
+ */
+void
+host_drain()
+{
+    uint32_t steps;
+
+    for (steps = 0; steps < HOST_DRAIN_MAX; steps++) {
+        host_step();
+        if (! (host_written || dump_active() || frame_active() ||
+               type_active || macro_active)) {
+            return;
+        }
+    }
+
+    fprintf(stderr, "still busy after %d steps\n", steps);
+    abort();
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2015-2023 by Willem Dijkstra <wpd@xs4all.nl>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the auhor nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * replay
+ *
+ * Run the fuzz target without libFuzzer: over the files given, e.g. a
+ * corpus or a crash, or over stdin. With -r, over random inputs instead,
+ * that are made of command letters, hex digits and valid frames, so that
+ * most of them get past the first byte.
+ *
+ * usage: replay [-v] [-r <count>] [-s <seed>] [file ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "host.h"
+
+#define REPLAY_INPUT_MAX    4096
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint8_t input[REPLAY_INPUT_MAX];
+
+static size_t
+replay_read(FILE *f)
+{
+    size_t len = fread(input, 1, sizeof(input), f);
+
+    if (! feof(f)) {
+        fprintf(stderr, "input truncated to %zu bytes\n", len);
+    }
+    return len;
+}
+
+static uint16_t
+replay_crc(uint16_t crc, uint8_t c)
+{
+    uint8_t i;
+
+    crc ^= (uint16_t)c << 8;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+static size_t
+replay_frame(uint8_t *buf, size_t room)
+{
+    static const char opcodes[] = "BCDEGIKAMNPQRTWXYZ?d";
+    uint16_t len = rand() % 64;
+    uint16_t crc = 0xffff;
+    uint16_t i;
+
+    if (room < (size_t)len + 6) {
+        return 0;
+    }
+
+    buf[0] = FRAME_STX;
+    buf[1] = len;
+    buf[2] = len >> 8;
+    buf[3] = opcodes[rand() % (sizeof(opcodes) - 1)];
+    for (i = 0; i < len; i++) {
+        buf[4 + i] = rand();
+    }
+    for (i = 1; i < len + 4; i++) {
+        crc = replay_crc(crc, buf[i]);
+    }
+    buf[len + 4] = crc;
+    buf[len + 5] = crc >> 8;
+
+    return len + 6;
+}
+
+static size_t
+replay_random()
+{
+    static const char alphabet[] =
+        "0123456789abcdef0123456789abcdef"
+        "@?ABCDEGIKLMNPQRSTUWXYZbdegiklprtuDMRV\n\n\n";
+    size_t size = rand() % 512;
+    size_t len = 0;
+    uint8_t pick;
+
+    while (len < size) {
+        pick = rand() % 64;
+        if (pick == 0) {
+            len += replay_frame(&input[len], size - len);
+            input[len++] = rand();
+        } else if (pick == 1) {
+            input[len++] = rand();
+        } else {
+            input[len++] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+    }
+    return len;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long count = 0;
+    unsigned long i;
+    FILE *f;
+    int ch;
+
+    srand(1);
+    while ((ch = getopt(argc, argv, "r:s:v")) != -1) {
+        switch (ch) {
+            case 'r':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                srand(strtoul(optarg, NULL, 0));
+                break;
+            case 'v':
+                host_echo = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-v] [-r <count>] [-s <seed>] [file ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        LLVMFuzzerTestOneInput(input, replay_random());
+    }
+
+    if (count) {
+        fprintf(stderr, "%lu random inputs, %llu bytes out\n",
+                count, (unsigned long long)host_output);
+        return 0;
+    }
+
+    if (optind == argc) {
+        LLVMFuzzerTestOneInput(input, replay_read(stdin));
+        return 0;
+    }
+
+    for (i = optind; i < (unsigned long)argc; i++) {
+        f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(input, replay_read(f));
+        fclose(f);
+    }
+
+    return 0;
+}